@@ -0,0 +1,171 @@
+#include "BlockPool.h"
+#include <string>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include "Placement.h"
+#include "Log.h"
+
+namespace jrNetWork {
+    /* Blocks of one thread, handed back to the pool when the thread exits */
+    struct _BlockCache {
+        /* Node of the thread at its last exchange with the pool */
+        int node = 0;
+        std::vector<char*> blocks;
+
+        ~_BlockCache()
+        {
+            BlockPool::instance()._give(node, blocks, blocks.size());
+        }
+    };
+
+    static thread_local _BlockCache blockCache;
+
+    BlockPool& BlockPool::instance()
+    {
+        /* Never destroyed, thread caches may return blocks during exit */
+        static BlockPool* pool = new BlockPool();
+        return *pool;
+    }
+
+    BlockPool::BlockPool()
+    {
+        int nodes = Placement::nodeCount();
+        for (int node = 0; node < nodes; ++node)
+        {
+            _nodes.push_back(std::make_unique<_Node>());
+        }
+    }
+
+    int BlockPool::_localNode() const
+    {
+        if (_nodes.size() == 1)
+        {
+            return 0;
+        }
+        int node = Placement::currentNode();
+        return (node < static_cast<int>(_nodes.size())) ? node : 0;
+    }
+
+    void BlockPool::_grow(int node)
+    {
+        char* arena = nullptr;
+        if (_hugePages)
+        {
+            void* p = ::mmap(nullptr, eArenaSize, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED)
+            {
+                arena = static_cast<char*>(p);
+                ++_hugeArenas;
+            }
+            else
+            {
+                /* No reserved huge pages: map twice the size to align an arena on 2 MB for THP */
+                p = ::mmap(nullptr, eArenaSize * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p != MAP_FAILED)
+                {
+                    std::uintptr_t base = reinterpret_cast<std::uintptr_t>(p);
+                    std::uintptr_t aligned = (base + eArenaSize - 1) & ~(static_cast<std::uintptr_t>(eArenaSize) - 1);
+                    if (aligned > base)
+                    {
+                        ::munmap(p, aligned - base);
+                    }
+                    ::munmap(reinterpret_cast<void*>(aligned + eArenaSize), base + eArenaSize * 2 - aligned - eArenaSize);
+                    arena = reinterpret_cast<char*>(aligned);
+                    ::madvise(arena, eArenaSize, MADV_HUGEPAGE);
+                }
+            }
+        }
+        else
+        {
+            void* p = ::mmap(nullptr, eArenaSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p != MAP_FAILED)
+            {
+                arena = static_cast<char*>(p);
+            }
+        }
+        if (!arena)
+        {
+            throw std::string("Block pool arena map failed: ") + strerror(errno);
+        }
+        /* Nothing touched the arena yet, its pages fault in on node whoever writes first */
+        if (_nodes.size() > 1)
+        {
+            Placement::bindMemory(arena, eArenaSize, node);
+        }
+        ++_arenas;
+        std::vector<char*>& blocks = _nodes[node]->free;
+        for (std::size_t off = 0; off < eArenaSize; off += eBlockSize)
+        {
+            blocks.push_back(arena + off);
+        }
+    }
+
+    void BlockPool::_take(int node, std::vector<char*>& cache, std::size_t n)
+    {
+        _Node& pool = *_nodes[node];
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        if (pool.free.size() < n)
+        {
+            _grow(node);
+        }
+        cache.insert(cache.end(), pool.free.end() - n, pool.free.end());
+        pool.free.resize(pool.free.size() - n);
+    }
+
+    void BlockPool::_give(int node, std::vector<char*>& cache, std::size_t n)
+    {
+        /* A block released on another node serves this one from now on */
+        _Node& pool = *_nodes[node];
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        pool.free.insert(pool.free.end(), cache.end() - n, cache.end());
+        cache.resize(cache.size() - n);
+    }
+
+    void BlockPool::setHugePages(bool on)
+    {
+        _hugePages = on;
+    }
+
+    char* BlockPool::allocate()
+    {
+        std::vector<char*>& cache = blockCache.blocks;
+        if (cache.empty())
+        {
+            blockCache.node = _localNode();
+            _take(blockCache.node, cache, eCacheBlocks / 2);
+        }
+        char* block = cache.back();
+        cache.pop_back();
+        ++_inUse;
+        return block;
+    }
+
+    void BlockPool::release(char* block)
+    {
+        std::vector<char*>& cache = blockCache.blocks;
+        cache.push_back(block);
+        --_inUse;
+        if (cache.size() > eCacheBlocks)
+        {
+            blockCache.node = _localNode();
+            _give(blockCache.node, cache, eCacheBlocks / 2);
+        }
+    }
+
+    std::size_t BlockPool::arenas() const
+    {
+        return _arenas;
+    }
+
+    std::size_t BlockPool::hugeArenas() const
+    {
+        return _hugeArenas;
+    }
+
+    std::size_t BlockPool::blocksInUse() const
+    {
+        return _inUse;
+    }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+
+namespace jrNetWork {
+    /* Process-wide pool of fixed-size I/O blocks, borrowed by connection buffers.
+     * Blocks are carved from 2 MB arenas which are never unmapped, so a busy server
+     * stops calling malloc/free for its buffers once warm. Each thread keeps a small
+     * cache and trades blocks with the shared free list in batches, so the lock is
+     * taken once per batch. Arenas can be backed by huge pages to cut TLB misses.
+     * Free lists and arenas are kept per NUMA node: a thread trades with the list of the
+     * node it runs on, whose arenas take their pages from that node.
+     */
+    class BlockPool {
+    public:
+        static constexpr std::size_t eBlockSize = 16 * 1024;
+        static constexpr std::size_t eArenaSize = 2 * 1024 * 1024;
+        /* Blocks a thread keeps before it gives half of them back */
+        static constexpr std::size_t eCacheBlocks = 64;
+
+    private:
+        /* Free blocks of one NUMA node */
+        struct _Node {
+            std::mutex mutex;
+            std::vector<char*> free;
+        };
+
+        /* Indexed by node id */
+        std::vector<std::unique_ptr<_Node> > _nodes;
+        std::atomic<bool> _hugePages{false};
+        std::atomic<std::size_t> _arenas{0};
+        std::atomic<std::size_t> _hugeArenas{0};
+        std::atomic<std::size_t> _inUse{0};
+
+        BlockPool();
+        /* Node of the calling thread, 0 on a machine which is not NUMA */
+        int _localNode() const;
+        /* Map one more arena on node into its free list, called with its lock held */
+        void _grow(int node);
+        /* Exchange batches with the thread caches, on the free list of node */
+        void _take(int node, std::vector<char*>& cache, std::size_t n);
+        void _give(int node, std::vector<char*>& cache, std::size_t n);
+
+        friend struct _BlockCache;
+
+    public:
+        /* Lives as long as the process, blocks may be returned from any thread at any time */
+        static BlockPool& instance();
+
+        /* Back arenas mapped from now on with 2 MB huge pages: reserved hugetlb pages when
+         * there are any, transparent huge pages otherwise. Set it before serving.
+         */
+        void setHugePages(bool on);
+        /* One block of eBlockSize bytes, throws when no memory can be mapped */
+        char* allocate();
+        /* Give back a block of allocate, from any thread */
+        void release(char* block);
+
+        std::size_t arenas() const;
+        /* Arenas on reserved huge pages */
+        std::size_t hugeArenas() const;
+        /* Blocks borrowed and not released */
+        std::size_t blocksInUse() const;
+
+    public:
+        /* Not allowed Operation */
+        BlockPool(const BlockPool&) = delete;
+        BlockPool& operator=(const BlockPool&) = delete;
+    };
+}
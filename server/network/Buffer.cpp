@@ -1,9 +1,90 @@
 #include "Buffer.h"
+#include <cstring>
+#include <utility>
+#include <sys/uio.h>
 
 namespace jrNetWork {
+    char* Buffer::_allocate(std::size_t capacity)
+    {
+        return (capacity == BlockPool::eBlockSize) ? BlockPool::instance().allocate() : new char[capacity];
+    }
+
+    void Buffer::_deallocate(char* data, std::size_t capacity)
+    {
+        if (capacity == BlockPool::eBlockSize)
+        {
+            BlockPool::instance().release(data);
+        }
+        else
+        {
+            delete[] data;
+        }
+    }
+
+    Buffer::Buffer(Buffer&& rhs) noexcept
+        : _data(std::exchange(rhs._data, nullptr))
+        , _capacity(std::exchange(rhs._capacity, 0))
+        , _readIndex(std::exchange(rhs._readIndex, 0))
+        , _writeIndex(std::exchange(rhs._writeIndex, 0))
+    {
+    }
+
+    Buffer& Buffer::operator=(Buffer&& rhs) noexcept
+    {
+        if (this != &rhs)
+        {
+            if (_data)
+            {
+                _deallocate(_data, _capacity);
+            }
+            _data = std::exchange(rhs._data, nullptr);
+            _capacity = std::exchange(rhs._capacity, 0);
+            _readIndex = std::exchange(rhs._readIndex, 0);
+            _writeIndex = std::exchange(rhs._writeIndex, 0);
+        }
+        return *this;
+    }
+
+    Buffer::~Buffer()
+    {
+        if (_data)
+        {
+            _deallocate(_data, _capacity);
+        }
+    }
+
+    void Buffer::_ensureWritable(std::size_t length)
+    {
+        if (_capacity - _writeIndex >= length)
+        {
+            return;
+        }
+        std::size_t readable = size();
+        if (_capacity - readable >= length)
+        {
+            /* Enough space in total: move the readable bytes down over the consumed ones */
+            std::memmove(_data, _data + _readIndex, readable);
+        }
+        else
+        {
+            /* The first allocation is a pooled block, a buffer outgrowing it goes to the heap */
+            std::size_t capacity = std::max({_capacity * 2, readable + length, BlockPool::eBlockSize});
+            char* grown = _allocate(capacity);
+            if (_data)
+            {
+                std::memcpy(grown, _data + _readIndex, readable);
+                _deallocate(_data, _capacity);
+            }
+            _data = grown;
+            _capacity = capacity;
+        }
+        _readIndex = 0;
+        _writeIndex = readable;
+    }
+
     std::size_t Buffer::size() const 
     {
-        return _buffer.size();
+        return _writeIndex - _readIndex;
     }
 
     bool Buffer::empty() const 
@@ -11,24 +92,106 @@ namespace jrNetWork {
         return size() == 0;
     }
 
+    std::size_t Buffer::capacity() const
+    {
+        return _capacity;
+    }
+
+    const char* Buffer::peek() const
+    {
+        return _data + _readIndex;
+    }
+
+    std::string_view Buffer::view() const
+    {
+        return std::string_view(peek(), size());
+    }
+
+    void Buffer::consume(std::size_t length)
+    {
+        _readIndex += std::min(length, size());
+        if (_readIndex == _writeIndex)
+        {
+            _readIndex = _writeIndex = 0;
+        }
+    }
+
+    std::size_t Buffer::shrink()
+    {
+        std::size_t readable = size();
+        std::size_t freed = 0;
+        if (_data && (readable == 0))
+        {
+            freed = _capacity;
+            _deallocate(_data, _capacity);
+            _data = nullptr;
+            _capacity = 0;
+        }
+        else if ((_capacity > BlockPool::eBlockSize) && (readable <= BlockPool::eBlockSize))
+        {
+            char* block = _allocate(BlockPool::eBlockSize);
+            std::memcpy(block, _data + _readIndex, readable);
+            _deallocate(_data, _capacity);
+            freed = _capacity - BlockPool::eBlockSize;
+            _data = block;
+            _capacity = BlockPool::eBlockSize;
+        }
+        else
+        {
+            return 0;
+        }
+        _readIndex = 0;
+        _writeIndex = readable;
+        return freed;
+    }
+
     std::string Buffer::getData() 
     {
-        return getData(_buffer.size());
+        return getData(size());
     }
 
     std::string Buffer::getData(std::uint32_t length)
     {
-        std::string ret;
-        if(size() <= length) 
+        std::string ret(peek(), std::min<std::size_t>(length, size()));
+        consume(ret.size());
+        return ret;
+    }
+
+    void Buffer::append(const char* data, std::size_t length)
+    {
+        _ensureWritable(length);
+        std::memcpy(_data + _writeIndex, data, length);
+        _writeIndex += length;
+    }
+
+    long Buffer::readFd(int fd, std::size_t maxBytes)
+    {
+        if (!_data)
         {
-            ret = _buffer;
-            _buffer.clear();
-        } 
-        else 
+            _ensureWritable(1);
+        }
+        char spill[eSpillSize];
+        std::size_t writable = std::min(_capacity - _writeIndex, maxBytes);
+        iovec vec[2];
+        vec[0].iov_base = _data + _writeIndex;
+        vec[0].iov_len = writable;
+        vec[1].iov_base = spill;
+        vec[1].iov_len = std::min(sizeof(spill), maxBytes - writable);
+        /* With a large free tail the spill area is not needed */
+        long n = ::readv(fd, vec, ((writable < sizeof(spill)) && (vec[1].iov_len > 0)) ? 2 : 1);
+        if (n <= 0)
         {
-            ret.append(_buffer.begin(), _buffer.begin()+length);
-            _buffer.erase(_buffer.begin(), _buffer.begin()+length);
+            return n;
         }
-        return ret;
+        if (static_cast<std::size_t>(n) <= writable)
+        {
+            _writeIndex += n;
+        }
+        else
+        {
+            _writeIndex += writable;
+            append(spill, n - writable);
+        }
+        return n;
     }
 }
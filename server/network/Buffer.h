@@ -1,28 +1,81 @@
 #pragma once
 
 #include <string>
+#include <string_view>
+#include <vector>
 #include <cstdint>
+#include <iterator>
+#include <algorithm>
+#include "BlockPool.h"
 
 namespace jrNetWork {
-    /* Buffer */
+    /* Buffer: growable byte array with separate read and write indices.
+     * Consuming from the front only moves the read index; the consumed space is
+     * reclaimed by moving the readable bytes down when the tail runs out, so
+     * reading a stream piece by piece costs amortized O(1) per byte.
+     * Readable bytes are contiguous and can be looked at in place.
+     * Storage up to one block is borrowed from the BlockPool, only larger buffers
+     * come from the heap.
+     */
     class Buffer {
     private:
-        std::string _buffer;
+        char* _data = nullptr;
+        /* BlockPool::eBlockSize for a pooled block */
+        std::size_t _capacity = 0;
+        std::size_t _readIndex = 0;
+        std::size_t _writeIndex = 0;
+
+        /* Make room for length more bytes behind the readable ones */
+        void _ensureWritable(std::size_t length);
+        static char* _allocate(std::size_t capacity);
+        static void _deallocate(char* data, std::size_t capacity);
 
     public:
+        Buffer() = default;
+        Buffer(Buffer&& rhs) noexcept;
+        Buffer& operator=(Buffer&& rhs) noexcept;
+        ~Buffer();
+
+        /* Stack area a read spills into when the buffer is full, so one syscall takes up to this much more */
+        static constexpr std::size_t eSpillSize = 64 * 1024;
+
         /* Get buffer current size */
         std::size_t size() const;
         /* Check buffer is or not empty */
         bool empty() const;
+        /* Bytes allocated */
+        std::size_t capacity() const;
+        /* Readable bytes in place, valid until the buffer is modified */
+        const char* peek() const;
+        std::string_view view() const;
+        /* Drop length readable bytes */
+        void consume(std::size_t length);
+        /* Give back storage the readable bytes do not need: all of it when the buffer is empty,
+         * the heap part when they fit in a pooled block. Returns the bytes freed.
+         */
+        std::size_t shrink();
         /* Get all readable or writable data from buffer */
         std::string getData();
         /* Get readable or writable data from buffer by length */
         std::string getData(std::uint32_t length);
         /* Append data to buffer's tail */
+        void append(const char* data, std::size_t length);
         template<typename Iterator>
         void append(Iterator start, Iterator end)
         {
-            _buffer.append(start, end);
+            std::size_t length = std::distance(start, end);
+            _ensureWritable(length);
+            std::copy(start, end, _data + _writeIndex);
+            _writeIndex += length;
         }
+        /* Read what fd has pending, at most maxBytes, with one readv into the free tail plus a
+         * stack spill area. Returns the bytes read, 0 at end of stream, -1 with errno set.
+         */
+        long readFd(int fd, std::size_t maxBytes = SIZE_MAX);
+
+    public:
+        /* Not allowed Operation */
+        Buffer(const Buffer&) = delete;
+        Buffer& operator=(const Buffer&) = delete;
     };
 }
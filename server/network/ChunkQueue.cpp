@@ -0,0 +1,117 @@
+#include "ChunkQueue.h"
+
+namespace jrNetWork {
+    std::size_t ChunkQueue::size() const
+    {
+        return _size;
+    }
+
+    bool ChunkQueue::empty() const
+    {
+        return _size == 0;
+    }
+
+    void ChunkQueue::push(std::string chunk)
+    {
+        push(Slice(std::move(chunk)));
+    }
+
+    void ChunkQueue::push(Slice chunk)
+    {
+        if (!chunk.empty())
+        {
+            _Chunk c;
+            c.length = chunk.size();
+            c.data = std::move(chunk);
+            _size += c.length;
+            _chunks.push_back(std::move(c));
+        }
+    }
+
+    void ChunkQueue::pushFile(std::shared_ptr<const OpenFile> file, std::size_t offset, std::size_t length)
+    {
+        if (file && (length > 0))
+        {
+            _Chunk c;
+            c.file = std::move(file);
+            c.offset = offset;
+            c.length = length;
+            _size += length;
+            _chunks.push_back(std::move(c));
+        }
+    }
+
+    void ChunkQueue::append(ChunkQueue&& rhs)
+    {
+        for (auto& c : rhs._chunks)
+        {
+            _chunks.push_back(std::move(c));
+        }
+        _size += rhs._size;
+        rhs._chunks.clear();
+        rhs._size = 0;
+    }
+
+    int ChunkQueue::fillIov(iovec* iov, int maxIov) const
+    {
+        int n = 0;
+        for (auto it = _chunks.begin(); (it != _chunks.end()) && !it->file && (n < maxIov); ++it, ++n)
+        {
+            iov[n].iov_base = const_cast<char*>(it->data.data());
+            iov[n].iov_len = it->length;
+        }
+        return n;
+    }
+
+    int ChunkQueue::pinIov(iovec* iov, int maxIov, std::vector<Slice>& pinned) const
+    {
+        int n = fillIov(iov, maxIov);
+        auto it = _chunks.begin();
+        for (int i = 0; i < n; ++i, ++it)
+        {
+            pinned.push_back(it->data);
+        }
+        return n;
+    }
+
+    Slice ChunkQueue::frontData() const
+    {
+        return _chunks.empty() ? Slice() : _chunks.front().data;
+    }
+
+    bool ChunkQueue::frontFile(int& fd, off_t& offset, std::size_t& length) const
+    {
+        if (_chunks.empty() || !_chunks.front().file)
+        {
+            return false;
+        }
+        fd = _chunks.front().file->fd;
+        offset = static_cast<off_t>(_chunks.front().offset);
+        length = _chunks.front().length;
+        return true;
+    }
+
+    void ChunkQueue::consume(std::size_t length)
+    {
+        _size -= length;
+        while (length > 0)
+        {
+            _Chunk& front = _chunks.front();
+            if (length < front.length)
+            {
+                if (front.file)
+                {
+                    front.offset += length;
+                }
+                else
+                {
+                    front.data = front.data.sub(length);
+                }
+                front.length -= length;
+                return;
+            }
+            length -= front.length;
+            _chunks.pop_front();
+        }
+    }
+}
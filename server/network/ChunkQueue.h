@@ -0,0 +1,67 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sys/uio.h>
+#include <sys/types.h>
+#include "FileCache.h"
+#include "Slice.h"
+
+namespace jrNetWork {
+    /* Queue of independent chunks waiting to be sent.
+     * Chunks are moved in and never merged, so a header and a large body go out
+     * together through one gather write without being copied into one string.
+     * In-memory chunks are Slices, so one body can be queued on many connections.
+     * A chunk may also be a range of an open file, which is sent with sendfile
+     * and never enters user space.
+     */
+    class ChunkQueue {
+    private:
+        struct _Chunk {
+            /* Unsent bytes of an in-memory chunk */
+            Slice data;
+            /* Set for a file range */
+            std::shared_ptr<const OpenFile> file;
+            /* Unsent part of the file: [offset, offset + length) */
+            std::size_t offset = 0;
+            std::size_t length = 0;
+        };
+
+    private:
+        std::deque<_Chunk> _chunks;
+        std::size_t _size = 0;
+
+    public:
+        /* Chunks handed to one gather write */
+        static constexpr int eMaxIov = 64;
+
+        /* Bytes queued */
+        std::size_t size() const;
+        bool empty() const;
+        /* Append a chunk, empty ones are dropped */
+        void push(std::string chunk);
+        /* Append shared bytes without copying them */
+        void push(Slice chunk);
+        /* Append length bytes of file from offset */
+        void pushFile(std::shared_ptr<const OpenFile> file, std::size_t offset, std::size_t length);
+        /* Move all chunks of rhs behind ours */
+        void append(ChunkQueue&& rhs);
+        /* Describe the in-memory chunks at the front in at most maxIov entries, returns the count
+         * (0 when the front is a file range)
+         */
+        int fillIov(iovec* iov, int maxIov) const;
+        /* fillIov which also keeps a share of each chunk described in pinned, for a write
+         * finishing after the queue is gone
+         */
+        int pinIov(iovec* iov, int maxIov, std::vector<Slice>& pinned) const;
+        /* Unsent bytes of the in-memory chunk at the front, empty when the front is a file range */
+        Slice frontData() const;
+        /* File range at the front, false when the front is in memory */
+        bool frontFile(int& fd, off_t& offset, std::size_t& length) const;
+        /* Drop length bytes from the front, after they were sent */
+        void consume(std::size_t length);
+    };
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#include <sys/resource.h>
+#include "Event.h"
+
+namespace jrNetWork
+{
+    /* Cheap reference to a connection: fd plus the generation of the slot when it was handed out */
+    struct ConnHandle
+    {
+        int id = -1;
+        std::uint32_t generation = 0;
+
+        explicit operator bool() const { return id >= 0; }
+    };
+
+    /* Fd-indexed connection table.
+     * Slots live in fixed-size chunks which are allocated on first use and never freed,
+     * so a lookup takes no lock. Only the loop thread inserts and erases; each erase bumps
+     * the slot generation, so events and handles of a closed connection are detected as
+     * stale once its fd is reused. The connection pointer of a slot is not atomic: besides
+     * the loop thread, only the handler which owns the connection through a one-shot event
+     * may look it up, as the loop does not erase it before that handler releases it.
+     */
+    template<class SocketType>
+    class ConnectionSlab
+    {
+    private:
+        using CltPtrType = std::shared_ptr<SocketType>;
+
+        struct _Slot
+        {
+            std::atomic<std::uint32_t> generation{0};
+            CltPtrType conn;
+        };
+
+        static constexpr std::size_t eChunkSize = 4096;
+        static constexpr std::size_t eMaxCapacity = 1 << 22;
+
+    private:
+        std::size_t _capacity;
+        std::unique_ptr<std::atomic<_Slot*>[]> _chunks;
+
+        _Slot* _slot(int id) const
+        {
+            if ((id < 0) || (static_cast<std::size_t>(id) >= _capacity))
+            {
+                return nullptr;
+            }
+            _Slot* chunk = _chunks[id / eChunkSize].load(std::memory_order_acquire);
+            return chunk ? &chunk[id % eChunkSize] : nullptr;
+        }
+
+        /* Upper bound of fds this process may open */
+        static std::size_t _fdLimit()
+        {
+            rlimit rl;
+            if ((-1 == ::getrlimit(RLIMIT_NOFILE, &rl)) || (rl.rlim_cur == RLIM_INFINITY))
+            {
+                return eMaxCapacity;
+            }
+            return std::min<std::size_t>(rl.rlim_cur, eMaxCapacity);
+        }
+
+    public:
+        explicit ConnectionSlab(std::size_t capacity = _fdLimit())
+            : _capacity(capacity)
+            , _chunks(new std::atomic<_Slot*>[(capacity + eChunkSize - 1) / eChunkSize])
+        {
+            for (std::size_t i = 0; i < (_capacity + eChunkSize - 1) / eChunkSize; ++i)
+            {
+                _chunks[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        ~ConnectionSlab()
+        {
+            for (std::size_t i = 0; i < (_capacity + eChunkSize - 1) / eChunkSize; ++i)
+            {
+                delete[] _chunks[i].load(std::memory_order_relaxed);
+            }
+        }
+
+        /* Loop thread: put a connection into the slot of its fd, returns an empty handle when fd is out of range */
+        ConnHandle insert(int id, CltPtrType conn)
+        {
+            if ((id < 0) || (static_cast<std::size_t>(id) >= _capacity))
+            {
+                return ConnHandle();
+            }
+            auto& chunk = _chunks[id / eChunkSize];
+            if (!chunk.load(std::memory_order_relaxed))
+            {
+                chunk.store(new _Slot[eChunkSize], std::memory_order_release);
+            }
+            _Slot* slot = _slot(id);
+            slot->conn = std::move(conn);
+            std::uint32_t generation = (slot->generation.load(std::memory_order_relaxed) + 1) & eGenerationMask;
+            slot->generation.store(generation, std::memory_order_release);
+            ConnHandle h;
+            h.id = id;
+            h.generation = generation;
+            return h;
+        }
+
+        /* Loop thread: release the slot if the handle is still current */
+        bool erase(const ConnHandle& h)
+        {
+            _Slot* slot = _slot(h.id);
+            if (!slot || (slot->generation.load(std::memory_order_relaxed) != h.generation) || !slot->conn)
+            {
+                return false;
+            }
+            slot->generation.store((h.generation + 1) & eGenerationMask, std::memory_order_release);
+            slot->conn.reset();
+            return true;
+        }
+
+        /* Loop thread, or the one-shot owner of the connection: the connection of a handle,
+         * null when it is stale
+         */
+        const CltPtrType* get(const ConnHandle& h) const
+        {
+            _Slot* slot = _slot(h.id);
+            if (!slot || (slot->generation.load(std::memory_order_acquire) != h.generation) || !slot->conn)
+            {
+                return nullptr;
+            }
+            return &slot->conn;
+        }
+
+        /* Current handle of a fd, empty when no connection lives there */
+        ConnHandle handle(int id) const
+        {
+            _Slot* slot = _slot(id);
+            if (!slot || !slot->conn)
+            {
+                return ConnHandle();
+            }
+            ConnHandle h;
+            h.id = id;
+            h.generation = slot->generation.load(std::memory_order_acquire);
+            return h;
+        }
+
+        std::size_t capacity() const { return _capacity; }
+
+    public:
+        /* Not allowed Operation */
+        ConnectionSlab(const ConnectionSlab&) = delete;
+        ConnectionSlab& operator=(const ConnectionSlab&) = delete;
+    };
+}
@@ -0,0 +1,486 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cerrno>
+#include "Event.h"
+#include "ConnectionSlab.h"
+#include "Log.h"
+#include "ChunkQueue.h"
+#include "Buffer.h"
+
+namespace jrNetWork
+{
+    template<class T = void> class Task;
+
+    /* Loop side of the coroutine API, implemented by EventLoop.
+     * Coroutines only run on a loop thread, which publishes its loop in current.
+     */
+    class _CoScheduler
+    {
+    public:
+        inline static thread_local _CoScheduler* current = nullptr;
+
+        virtual ~_CoScheduler() = default;
+        /* Whether the connection is still the one the coroutine was started for */
+        virtual bool _coAlive(const ConnHandle& h) const = 0;
+        /* Resume co once the connection is ready for type, false when it is gone */
+        virtual bool _coWaitIo(const ConnHandle& h, EventType type, std::coroutine_handle<> co) = 0;
+        /* Resume co after delay */
+        virtual void _coSleep(std::coroutine_handle<> co, std::chrono::milliseconds delay) = 0;
+        /* Run work on the pool and resume co on the loop thread when it is done, false without a pool.
+         * What work throws is stored in error for the coroutine to rethrow.
+         */
+        virtual bool _coOffload(std::function<void()>& work, std::exception_ptr& error, std::coroutine_handle<> co) = 0;
+        /* The coroutine is about to wait for input with nothing left in buffer */
+        virtual void _coBufferIdle(Buffer& buffer) = 0;
+        /* Input the loop's backend already received for the connection, with the results of
+         * Socket::recvSome in n; false when the coroutine reads the socket itself
+         */
+        virtual bool _coRecv(const ConnHandle& h, Buffer& buffer, long& n) = 0;
+        virtual bool _coRecv(const ConnHandle& h, char* buf, std::size_t length, long& n) = 0;
+        /* Hand the front of queue to the backend and resume co once it is written, result then
+         * holds what the write returned (bytes or -errno, 0 when the connection went away).
+         * False when the coroutine writes the socket itself.
+         */
+        virtual bool _coSend(const ConnHandle& h, const ChunkQueue& queue, long& result, std::coroutine_handle<> co) = 0;
+    };
+
+    namespace _coDetail
+    {
+        inline void logException(const std::exception_ptr& e)
+        {
+            try
+            {
+                std::rethrow_exception(e);
+            }
+            catch (const std::exception& ex)
+            {
+                LOGWARN() << "Coroutine exited by exception: " << ex.what() << std::endl;
+            }
+            catch (const std::string& msg)
+            {
+                LOGWARN() << "Coroutine exited by exception: " << msg << std::endl;
+            }
+            catch (...)
+            {
+                LOGWARN() << "Coroutine exited by unknown exception" << std::endl;
+            }
+        }
+
+        /* A finished task resumes its awaiter, a detached one frees itself */
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            template<class Promise>
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+            {
+                auto& promise = h.promise();
+                std::coroutine_handle<> continuation = promise.continuation;
+                if (promise.detached)
+                {
+                    if (promise.exception)
+                    {
+                        logException(promise.exception);
+                    }
+                    h.destroy();
+                }
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        struct PromiseBase
+        {
+            std::coroutine_handle<> continuation;
+            bool detached = false;
+            std::exception_ptr exception;
+
+            /* Tasks are lazy, they start when awaited or detached */
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            FinalAwaiter final_suspend() const noexcept { return {}; }
+            void unhandled_exception() { exception = std::current_exception(); }
+        };
+
+        template<class T>
+        struct Promise : PromiseBase
+        {
+            std::optional<T> value;
+
+            Task<T> get_return_object();
+
+            template<class U>
+            void return_value(U&& v)
+            {
+                value.emplace(std::forward<U>(v));
+            }
+
+            T result()
+            {
+                if (exception)
+                {
+                    std::rethrow_exception(exception);
+                }
+                return std::move(*value);
+            }
+        };
+
+        template<>
+        struct Promise<void> : PromiseBase
+        {
+            Task<void> get_return_object();
+
+            void return_void() const noexcept {}
+
+            void result()
+            {
+                if (exception)
+                {
+                    std::rethrow_exception(exception);
+                }
+            }
+        };
+    }
+
+    /* Coroutine task: co_await it from another task to get its result, or detach it to let
+     * it run on its own. Exceptions propagate to the awaiter; a detached task logs them.
+     */
+    template<class T>
+    class Task
+    {
+    public:
+        using promise_type = _coDetail::Promise<T>;
+
+    private:
+        std::coroutine_handle<promise_type> _handle;
+
+    public:
+        explicit Task(std::coroutine_handle<promise_type> h = nullptr)
+            : _handle(h)
+        {
+        }
+
+        Task(Task&& rhs) noexcept
+            : _handle(std::exchange(rhs._handle, nullptr))
+        {
+        }
+
+        Task& operator=(Task&& rhs) noexcept
+        {
+            if (this != &rhs)
+            {
+                if (_handle)
+                {
+                    _handle.destroy();
+                }
+                _handle = std::exchange(rhs._handle, nullptr);
+            }
+            return *this;
+        }
+
+        ~Task()
+        {
+            if (_handle)
+            {
+                _handle.destroy();
+            }
+        }
+
+        /* Start the task and let it free itself when it finishes */
+        void detach()
+        {
+            std::coroutine_handle<promise_type> h = std::exchange(_handle, nullptr);
+            if (h)
+            {
+                h.promise().detached = true;
+                h.resume();
+            }
+        }
+
+        bool await_ready() const noexcept { return !_handle || _handle.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            _handle.promise().continuation = awaiting;
+            return _handle;
+        }
+
+        T await_resume()
+        {
+            return _handle.promise().result();
+        }
+
+    public:
+        /* Not allowed Operation */
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+    };
+
+    template<class T>
+    Task<T> _coDetail::Promise<T>::get_return_object()
+    {
+        return Task<T>(std::coroutine_handle<Promise<T> >::from_promise(*this));
+    }
+
+    inline Task<void> _coDetail::Promise<void>::get_return_object()
+    {
+        return Task<void>(std::coroutine_handle<Promise<void> >::from_promise(*this));
+    }
+
+    namespace _coDetail
+    {
+        struct IoAwaiter
+        {
+            _CoScheduler* scheduler;
+            ConnHandle conn;
+            EventType type;
+
+            bool await_ready() const noexcept { return false; }
+            /* Stays running when the connection is gone */
+            bool await_suspend(std::coroutine_handle<> co) { return scheduler->_coWaitIo(conn, type, co); }
+            void await_resume() const noexcept {}
+        };
+
+        /* Resumes with whether the write was handed to the backend, the result is in result */
+        struct SendAwaiter
+        {
+            _CoScheduler* scheduler;
+            ConnHandle conn;
+            const ChunkQueue& queue;
+            long result = 0;
+            bool submitted = false;
+
+            bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> co)
+            {
+                submitted = scheduler->_coSend(conn, queue, result, co);
+                return submitted;
+            }
+
+            bool await_resume() const noexcept { return submitted; }
+        };
+
+        struct SleepAwaiter
+        {
+            std::chrono::milliseconds delay;
+
+            bool await_ready() const noexcept { return delay.count() <= 0; }
+            void await_suspend(std::coroutine_handle<> co) { _CoScheduler::current->_coSleep(co, delay); }
+            void await_resume() const noexcept {}
+        };
+
+        struct OffloadAwaiter
+        {
+            std::function<void()> work;
+            std::exception_ptr error = nullptr;
+
+            bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(std::coroutine_handle<> co)
+            {
+                if (_CoScheduler::current->_coOffload(work, error, co))
+                {
+                    return true;
+                }
+                try
+                {
+                    work();
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+                return false;
+            }
+
+            void await_resume() const
+            {
+                if (error)
+                {
+                    std::rethrow_exception(error);
+                }
+            }
+        };
+    }
+
+    /* Suspend the calling coroutine for delay, the loop goes on serving others meanwhile */
+    template<class Rep, class Period>
+    _coDetail::SleepAwaiter sleep_for(std::chrono::duration<Rep, Period> delay)
+    {
+        return _coDetail::SleepAwaiter{std::chrono::ceil<std::chrono::milliseconds>(delay)};
+    }
+
+    /* Run blocking or CPU heavy work on the loop's thread pool (inline without one),
+     * the coroutine resumes on the loop thread afterwards and co_await rethrows what work threw
+     */
+    inline _coDetail::OffloadAwaiter offload(std::function<void()> work)
+    {
+        return _coDetail::OffloadAwaiter{std::move(work)};
+    }
+
+    /* Connection as seen by a coroutine handler.
+     * read and write try the socket first and suspend on EAGAIN until the loop reports
+     * the fd ready, so a slow client costs a suspended frame instead of a thread.
+     * On a completion backend (io_uring) the loop reads ahead into its own buffers and
+     * write suspends until the submitted write completes, so neither costs a syscall.
+     */
+    template<class SocketType>
+    class AsyncSocket
+    {
+    private:
+        _CoScheduler* _scheduler;
+        ConnHandle _conn;
+        std::shared_ptr<SocketType> _socket;
+
+        static bool _wouldBlock()
+        {
+            return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+        }
+
+    public:
+        AsyncSocket(_CoScheduler* scheduler, ConnHandle conn, std::shared_ptr<SocketType> socket)
+            : _scheduler(scheduler)
+            , _conn(conn)
+            , _socket(std::move(socket))
+        {
+        }
+
+        const std::shared_ptr<SocketType>& socket() const { return _socket; }
+
+        /* Whether the loop still serves the connection */
+        bool isOpen() const
+        {
+            return !_socket->isPeerClosed() && _scheduler->_coAlive(_conn);
+        }
+
+        /* Read what is pending, at most maxBytes, waiting until something arrives.
+         * Empty when the peer closed or the connection broke.
+         */
+        Task<std::string> read(std::size_t maxBytes = 4096)
+        {
+            std::string data(maxBytes, '\0');
+            while (isOpen())
+            {
+                long n;
+                if (!_scheduler->_coRecv(_conn, &data[0], maxBytes, n))
+                {
+                    n = _socket->recvSome(&data[0], maxBytes);
+                }
+                if (n > 0)
+                {
+                    data.resize(n);
+                    co_return data;
+                }
+                if ((n < 0) && _wouldBlock())
+                {
+                    co_await _coDetail::IoAwaiter{_scheduler, _conn, EventType::READ};
+                }
+                else if ((n == 0) || (errno != EINTR))
+                {
+                    break;
+                }
+            }
+            co_return std::string();
+        }
+
+        /* Append what is pending to buffer with one readv, waiting until something arrives.
+         * Returns the bytes read, 0 when the peer closed or the connection broke.
+         */
+        Task<std::size_t> read(Buffer& buffer)
+        {
+            while (isOpen())
+            {
+                long n;
+                if (!_scheduler->_coRecv(_conn, buffer, n))
+                {
+                    n = _socket->recvSome(buffer);
+                }
+                if (n > 0)
+                {
+                    co_return static_cast<std::size_t>(n);
+                }
+                if ((n < 0) && _wouldBlock())
+                {
+                    if (buffer.empty())
+                    {
+                        _scheduler->_coBufferIdle(buffer);
+                    }
+                    co_await _coDetail::IoAwaiter{_scheduler, _conn, EventType::READ};
+                }
+                else if ((n == 0) || (errno != EINTR))
+                {
+                    break;
+                }
+            }
+            co_return 0;
+        }
+
+        /* Write all of data, waiting whenever the socket buffer is full.
+         * False when the connection broke before everything was written.
+         */
+        Task<bool> write(std::string data)
+        {
+            std::vector<std::string> chunks;
+            chunks.push_back(std::move(data));
+            return write(std::move(chunks));
+        }
+
+        /* Write the chunks in order with gather writes, they are never merged into one buffer */
+        Task<bool> write(std::vector<std::string> chunks)
+        {
+            ChunkQueue queue;
+            for (auto& chunk : chunks)
+            {
+                queue.push(std::move(chunk));
+            }
+            return write(std::move(queue));
+        }
+
+        /* Write a prepared queue, file ranges go out by sendfile */
+        Task<bool> write(ChunkQueue queue)
+        {
+            while (!queue.empty() && isOpen())
+            {
+                /* A completion backend batches the write with the loop's other submissions */
+                _coDetail::SendAwaiter send{_scheduler, _conn, queue};
+                long n;
+                if (co_await send)
+                {
+                    n = send.result;
+                    if (n > 0)
+                    {
+                        queue.consume(n);
+                    }
+                    else if (n < 0)
+                    {
+                        errno = static_cast<int>(-n);
+                        n = -1;
+                    }
+                }
+                else
+                {
+                    n = _socket->sendSome(queue);
+                }
+                if ((n < 0) && _wouldBlock())
+                {
+                    co_await _coDetail::IoAwaiter{_scheduler, _conn, EventType::WRITE};
+                }
+                else if ((n == 0) || ((n < 0) && (errno != EINTR)))
+                {
+                    break;
+                }
+            }
+            co_return queue.empty();
+        }
+    };
+}
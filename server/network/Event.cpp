@@ -5,7 +5,8 @@ namespace jrNetWork
 	Event::Event(const _NativeEvent& ne)
 	{
 		id = ne.data.fd;
-		if ((ne.events & EPOLLHUP) || (ne.events & EPOLLERR))
+		generation = static_cast<std::uint32_t>(ne.data.u64 >> 32) & eGenerationMask;
+		if (ne.events & EPOLLHUP)
 		{
 			type = EventType::ConnClosed;
 		}
@@ -17,12 +18,18 @@ namespace jrNetWork
 		{
 			type = EventType::WRITE;
 		} 
+		else if (ne.events & EPOLLERR)
+		{
+			/* Error queue of a zero-copy socket, or an error the next read or write reports */
+			type = EventType::ErrQueue;
+		}
 	}
 
 	Event::Event(_NativeEvent&& ne)
 	{
 		id = ne.data.fd;
-		if ((ne.events & EPOLLHUP) || (ne.events & EPOLLERR))
+		generation = static_cast<std::uint32_t>(ne.data.u64 >> 32) & eGenerationMask;
+		if (ne.events & EPOLLHUP)
 		{
 			type = EventType::ConnClosed;
 		}
@@ -34,12 +41,18 @@ namespace jrNetWork
 		{
 			type = EventType::WRITE;
 		}
+		else if (ne.events & EPOLLERR)
+		{
+			/* Error queue of a zero-copy socket, or an error the next read or write reports */
+			type = EventType::ErrQueue;
+		}
 	}
 
 	Event& Event::operator=(const _NativeEvent& ne)
 	{
 		id = ne.data.fd;
-		if ((ne.events & EPOLLHUP) || (ne.events & EPOLLERR))
+		generation = static_cast<std::uint32_t>(ne.data.u64 >> 32) & eGenerationMask;
+		if (ne.events & EPOLLHUP)
 		{
 			type = EventType::ConnClosed;
 		}
@@ -51,13 +64,19 @@ namespace jrNetWork
 		{
 			type = EventType::WRITE;
 		}
+		else if (ne.events & EPOLLERR)
+		{
+			/* Error queue of a zero-copy socket, or an error the next read or write reports */
+			type = EventType::ErrQueue;
+		}
 		return *this;
 	}
 
 	Event& Event::operator=(_NativeEvent&& ne)
 	{
 		id = ne.data.fd;
-		if ((ne.events & EPOLLHUP) || (ne.events & EPOLLERR))
+		generation = static_cast<std::uint32_t>(ne.data.u64 >> 32) & eGenerationMask;
+		if (ne.events & EPOLLHUP)
 		{
 			type = EventType::ConnClosed;
 		}
@@ -69,6 +88,11 @@ namespace jrNetWork
 		{
 			type = EventType::WRITE;
 		}
+		else if (ne.events & EPOLLERR)
+		{
+			/* Error queue of a zero-copy socket, or an error the next read or write reports */
+			type = EventType::ErrQueue;
+		}
 		return *this;
 	}
 
@@ -12,16 +12,23 @@ namespace jrNetWork
         READ,
         WRITE,
         ConnClosed,
+        ErrQueue,
         SIGNAL,
-        Timeout
+        Timeout,
+        WAKEUP
     };
 
     using _NativeEvent = epoll_event;
 
+    /* Connection generations keep 24 bits, so backends can pack them with the fd */
+    constexpr std::uint32_t eGenerationMask = 0xffffff;
+
     struct Event
     {
         int id;
         EventType type;
+        /* Generation of the connection slot, stale events of a reused fd do not match it */
+        std::uint32_t generation = 0;
 
         Event() = default;
         Event(const _NativeEvent& ne);
@@ -2,11 +2,16 @@
 
 #include <memory>
 #include <cstring>
+#include <chrono>
 #include <cstdint>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 #include <unordered_map>
 #include <signal.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
 #include "Event.h"
 #include "Multiplexer.h"
 #include "Socket.h"
@@ -14,72 +19,991 @@
 #include "ThreadPool.h"
 #include "Log.h"
 #include "Ues.h"
+#include "ConnectionSlab.h"
+#include "MpscQueue.h"
+#include "Placement.h"
+#include "Coroutine.h"
 
 namespace jrNetWork
 {
+    template<class SocketType> class EventLoopGroup;
+
+    /* What a loop does when its connections reach the high-water mark */
+    enum class OverloadPolicy
+    {
+        PAUSE_ACCEPT,   // Stop accepting, new connections wait in the backlog
+        REJECT          // Accept, send the canned response and close
+    };
+
     template<class SocketType>
-	class EventLoop
+	class EventLoop : private _CoScheduler
 	{
+        template<class> friend class EventLoopGroup;
     private:
         using CltPtrType = std::shared_ptr<SocketType>;
         using TimeoutCallbackType = std::function<void(CltPtrType)>;
-        using IOCallbackType = std::function<void(CltPtrType)>;
+        using IOCallbackType = std::function<void(const CltPtrType&)>;
+        using CoHandlerType = std::function<Task<>(AsyncSocket<SocketType>)>;
+
+        /* Coroutines of a connection: the handler serving it, and where it is suspended */
+        struct _CoSlot
+        {
+            ConnHandle owner;
+            std::coroutine_handle<> reader;
+            std::coroutine_handle<> writer;
+            /* Where the result of a backend write goes, while writer waits for its completion */
+            long* sendResult = nullptr;
+        };
 
     private:
         SocketType socket;
+        /* Listen port, 0 for a sub-loop which is fed connections by an acceptor loop */
+        std::uint16_t _port;
+        bool _reusePort = false;
+        int _backlog = SOMAXCONN;
+        /* Connections accepted per listen event before yielding to the other events */
+        std::uint32_t _acceptBudget = 64;
+        /* Spare fd given up to accept-and-close a connection when the process is out of fds */
+        int _reserveFd = -1;
+        /* Only one loop of a group reads the process-wide signal source */
+        bool _handleSignals = true;
         std::unique_ptr<_MultiplexerBase> _multiplexer;
-        std::unordered_map<int, CltPtrType> _idSocketTbl;
+        ConnectionSlab<SocketType> _connections;
+        std::atomic<std::size_t> _connNum{0};
+        /* Connections handed over by _queueConnection and not added yet */
+        std::atomic<std::size_t> _queuedNum{0};
+        /* Admission control: 0 high-water mark for unlimited */
+        std::size_t _highWater = 0;
+        std::size_t _lowWater = 0;
+        OverloadPolicy _overloadPolicy = OverloadPolicy::PAUSE_ACCEPT;
+        std::string _rejectResponse;
+        /* Connections admitted by this loop and not closed yet, wherever they are served */
+        std::atomic<std::size_t> _admittedNum{0};
+        std::atomic<std::uint64_t> _rejectedNum{0};
+        std::atomic<bool> _acceptPaused{false};
+        /* REJECT policy: set at the high-water mark, cleared once the count drops to the low-water mark */
+        bool _rejecting = false;
+        /* Loop which admitted the connections served here: the acceptor of a group, or itself */
+        EventLoop* _admissionOwner = this;
         _UnifiedEventSource _ues;
+        /* Acceptor mode: accepted sockets are handed to this instead of being served here */
+        std::function<void(CltPtrType)> _acceptDispatcher;
+        /* Wakeup eventfd and the tasks posted to the loop thread */
+        int _wakeupFd;
+        MpscQueue<std::function<void()> > _pendingTasks;
+        /* Written by run, read by any thread posting a task (e.g. an acceptor feeding a loop which is still starting) */
+        std::atomic<std::thread::id> _loopThreadId{};
+        /* Busy poll budget in microseconds, 0 for off */
+        std::uint32_t _busyPollUs = 0;
+        bool _busyPollWarned = false;
+        /* Options of the listener and the connections */
+        SocketTuning _tuning;
+        bool _tuningWarned = false;
+        /* Chunks from this size on are sent with MSG_ZEROCOPY, 0 for off */
+        std::size_t _zeroCopyThreshold = 0;
+        bool _zeroCopyWarned = false;
+        /* Water marks of each connection's unsent output, 0 high-water mark for unbounded */
+        std::size_t _sendHighWater = 0;
+        std::size_t _sendLowWater = 0;
+        /* Input each connection buffers ahead of its read handler, 0 for unbounded */
+        std::size_t _recvLimit = 0;
+        std::size_t _recvResume = 0;
+        /* Buffer release: after a connection waited this long for input (0 for never), and / or
+         * as soon as it has drained
+         */
+        std::chrono::milliseconds _releaseIdle{0};
+        bool _releaseOnDrain = false;
+        std::atomic<std::uint64_t> _reclaimedBytes{0};
+        std::atomic<std::uint64_t> _reclaimedBuffers{0};
         /* Event handlers */
         IOCallbackType _readEvHandler;
         IOCallbackType _writeEvHandler;
+        IOCallbackType _highWaterHandler;
+        IOCallbackType _drainedHandler;
         TimeoutCallbackType _timeoutCallback;
-        /* Timer */
-        TimerContainer<SocketType> _timer;
-        /* Thread pool */
-        ThreadPool _threadPool;
+        /* Coroutine handler, loop thread only */
+        CoHandlerType _coHandler;
+        std::vector<_CoSlot> _coSlots;
+        /* Pool mode: the connection a worker runs a handler for, by fd, loop thread only */
+        std::vector<ConnHandle> _workerOwners;
+        TimerContainer<std::coroutine_handle<> > _sleepTimers;
+        /* Idle timers of the connections, loop thread only */
+        TimerContainer<ConnHandle> _timer;
+        std::vector<TimerHandle> _connTimers;
+        std::chrono::milliseconds _idleTimeout{0};
+        /* Buffer release timers, only pending while a connection waits for input, loop thread only */
+        TimerContainer<ConnHandle> _releaseTimer;
+        std::vector<TimerHandle> _releaseTimers;
+        /* Thread pool, null when events are handled inline on the loop thread */
+        std::unique_ptr<ThreadPool> _threadPool;
+        /* Workers of the pool, which is started by run on the placed loop thread */
+        std::uint16_t _poolSize;
+        /* Placement: cpu of the loop thread (-1 floats), cpus of the workers (empty for the loop's node) */
+        int _loopCpu = -1;
+        std::vector<int> _workerCpus;
+        bool _numaLocal = true;
         /* Signal-Handler table */
         std::unordered_map<int, std::function<void()> > _sigHandlerTbl;
 
         /* Socket init */
         void _socketInit(std::uint16_t port)
         {
+            if (_reusePort)
+            {
+                socket.enableReusePort();
+            }
+            if (!socket.tuneListener(_tuning))
+            {
+                LOGWARN() << "Listener tuning partly refused, " << ::strerror(errno) << std::endl;
+            }
             /* Bind ip address and port */
             socket.bind(port);
             /* Listen target port */
-            socket.listen();
+            socket.listen(_backlog);
+            _reserveFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
             /* Regist listen event */
             Event ev;
             ev.id = socket._id;
             ev.type = EventType::LISTEN;
             _multiplexer->registEvent(ev);
-            /* Regist signal event */
-            ev.id = _UnifiedEventSource::_uesfd[0];
-            ev.type = EventType::SIGNAL;
-            _multiplexer->registEvent(ev);
         }
 
-        /* Do Accept */
-        void _doAccept()
+        /* Run task on thread pool, or inline when the loop has no pool */
+        void _dispatch(ThreadPool::TaskType task)
         {
-            CltPtrType cltPtr = socket.accept();
-            if (cltPtr)
+            if (_threadPool)
+            {
+                _threadPool->addTask(std::move(task));
+            }
+            else
+            {
+                task();
+            }
+        }
+
+        /* Loop thread: pin it, then start the workers, which inherit its memory policy */
+        void _applyPlacement()
+        {
+            std::vector<int> workerCpus = _workerCpus;
+            if ((_loopCpu >= 0) && Placement::pinThread(::pthread_self(), _loopCpu))
+            {
+                if (_numaLocal)
+                {
+                    Placement::useLocalMemory();
+                }
+                if (workerCpus.empty())
+                {
+                    workerCpus = Placement::cpusOfNode(Placement::nodeOfCpu(_loopCpu));
+                }
+            }
+            if (_poolSize && !_threadPool)
+            {
+                _threadPool = std::make_unique<ThreadPool>(_poolSize, workerCpus);
+            }
+        }
+
+        /* Serve a connection on this loop */
+        void _addConnection(CltPtrType cltPtr)
+        {
+            int id = cltPtr->_id;
+            ConnHandle h = _connections.insert(id, cltPtr);
+            if (!h)
+            {
+                LOGWARN() << "Connection slab is full, fd " << id << std::endl;
+                ::close(id);
+                _releaseAdmission();
+                return;
+            }
+            /* From now on the fd is closed by _closeConnection only */
+            cltPtr->_loopOwned = true;
+            Event readEv;
+            readEv.id = id;
+            readEv.type = EventType::READ;
+            readEv.generation = h.generation;
+            /* Coroutine connections are served on the loop thread, a completion backend reads for them */
+            if (!_coHandler || !_multiplexer->startReceive(readEv))
             {
-                Event readEv;
-                readEv.id = cltPtr->_id;
-                readEv.type = EventType::READ;
                 _multiplexer->registEvent(readEv);
-                _idSocketTbl[cltPtr->_id] = cltPtr;
-                _timer.addTask(cltPtr);
+            }
+            if ((_busyPollUs > 0) && !cltPtr->enableBusyPoll(static_cast<int>(_busyPollUs)) && !_busyPollWarned)
+            {
+                /* Raising SO_BUSY_POLL needs CAP_NET_ADMIN, the loop still spins without it */
+                LOGWARN() << "Socket busy poll unavailable, " << ::strerror(errno) << std::endl;
+                _busyPollWarned = true;
+            }
+            if (!cltPtr->tuneConnection(_tuning) && !_tuningWarned)
+            {
+                LOGWARN() << "Connection tuning partly refused, " << ::strerror(errno) << std::endl;
+                _tuningWarned = true;
+            }
+            if (_zeroCopyThreshold && !cltPtr->enableZeroCopy(_zeroCopyThreshold) && !_zeroCopyWarned)
+            {
+                LOGWARN() << "Zero-copy send unavailable, " << ::strerror(errno) << std::endl;
+                _zeroCopyWarned = true;
+            }
+            if (_recvLimit)
+            {
+                cltPtr->setRecvLimit(_recvLimit, _recvResume);
+            }
+            if (_sendHighWater)
+            {
+                /* The socket must not own itself through its callbacks */
+                std::weak_ptr<SocketType> weakClt = cltPtr;
+                cltPtr->setWaterMarks(_sendHighWater, _sendLowWater,
+                    [this, weakClt]()->void
+                    {
+                        CltPtrType clt = weakClt.lock();
+                        if (clt && _highWaterHandler)
+                        {
+                            _highWaterHandler(clt);
+                        }
+                    },
+                    [this, weakClt]()->void
+                    {
+                        CltPtrType clt = weakClt.lock();
+                        if (clt && _drainedHandler)
+                        {
+                            _drainedHandler(clt);
+                        }
+                    });
+            }
+            _refreshIdleTimer(h);
+            ++_connNum;
+        }
+
+        /* Loop thread: (re)start the idle timer of a connection, unless idle timeouts are off
+         * (no timeout, or nobody to tell)
+         */
+        void _refreshIdleTimer(const ConnHandle& h)
+        {
+            if ((_idleTimeout.count() <= 0) || !_timeoutCallback)
+            {
+                return;
+            }
+            if (static_cast<std::size_t>(h.id) >= _connTimers.size())
+            {
+                _connTimers.resize(std::max<std::size_t>(h.id + 1, _connTimers.size() * 2));
+            }
+            _connTimers[h.id] = _timer.refresh(_connTimers[h.id], h, _idleTimeout);
+        }
+
+        /* Loop thread: release the buffers of the connection after the release period, unless
+         * an event hands it to the handler first
+         */
+        void _armRelease(const ConnHandle& h)
+        {
+            if (static_cast<std::size_t>(h.id) >= _releaseTimers.size())
+            {
+                _releaseTimers.resize(std::max<std::size_t>(h.id + 1, _releaseTimers.size() * 2));
+            }
+            _releaseTimers[h.id] = _releaseTimer.refresh(_releaseTimers[h.id], h, _releaseIdle);
+        }
+
+        void _disarmRelease(const ConnHandle& h)
+        {
+            if (static_cast<std::size_t>(h.id) < _releaseTimers.size())
+            {
+                _releaseTimer.cancel(_releaseTimers[h.id]);
+            }
+        }
+
+        void _reclaim(std::size_t bytes)
+        {
+            if (bytes > 0)
+            {
+                _reclaimedBytes += bytes;
+                ++_reclaimedBuffers;
+            }
+        }
+
+        /* Loop thread: a pool worker runs a handler for the connection, or its coroutine is busy
+         * with anything but waiting for input
+         */
+        bool _isOwned(const ConnHandle& h) const
+        {
+            if (_coHandler)
+            {
+                return (static_cast<std::size_t>(h.id) < _coSlots.size()) && _isSameConn(_coSlots[h.id].owner, h)
+                    && !_coSlots[h.id].reader;
+            }
+            return (static_cast<std::size_t>(h.id) < _workerOwners.size()) && _isSameConn(_workerOwners[h.id], h);
+        }
+
+        /* Loop thread: the connection goes to a pool worker, or comes back from it */
+        void _setWorkerOwner(const ConnHandle& h, bool owned)
+        {
+            if (static_cast<std::size_t>(h.id) >= _workerOwners.size())
+            {
+                _workerOwners.resize(std::max<std::size_t>(h.id + 1, _workerOwners.size() * 2));
+            }
+            _workerOwners[h.id] = owned ? h : ConnHandle();
+        }
+
+        /* Loop thread: expire idle timers, the handler sees connections which are still open
+         * and nobody else owns. A connection it disconnects or shuts down is released here,
+         * no event would report it. Sleeping coroutines are resumed here as well.
+         */
+        void _expireTimers()
+        {
+            _timer.tick([this](const ConnHandle& h)->void
+            {
+                const CltPtrType* cltPtr = _connections.get(h);
+                if (!cltPtr || !_timeoutCallback)
+                {
+                    return;
+                }
+                if (_isOwned(h))
+                {
+                    /* Busy rather than idle, look again one period later */
+                    _refreshIdleTimer(h);
+                    return;
+                }
+                _timeoutCallback(*cltPtr);
+                if ((*cltPtr)->isPeerClosed())
+                {
+                    _closeConnection(h);
+                }
+            });
+            _sleepTimers.tick([](const std::coroutine_handle<>& co)->void
+            {
+                co.resume();
+            });
+            /* A pending release timer means no handler owns the connection */
+            _releaseTimer.tick([this](const ConnHandle& h)->void
+            {
+                const CltPtrType* cltPtr = _connections.get(h);
+                if (cltPtr)
+                {
+                    _reclaim((*cltPtr)->releaseIdleMemory());
+                }
+            });
+        }
+
+        /* Milliseconds until the earliest timer of the wheels, -1 when none is pending */
+        int _nextTimeout() const
+        {
+            int timeout = -1;
+            for (int t : {_timer.nextTimeout(), _sleepTimers.nextTimeout(), _releaseTimer.nextTimeout()})
+            {
+                if ((t >= 0) && ((timeout < 0) || (t < timeout)))
+                {
+                    timeout = t;
+                }
+            }
+            return timeout;
+        }
+
+        _CoSlot& _coSlotOf(int id)
+        {
+            if (static_cast<std::size_t>(id) >= _coSlots.size())
+            {
+                _coSlots.resize(std::max<std::size_t>(id + 1, _coSlots.size() * 2));
+            }
+            return _coSlots[id];
+        }
+
+        static bool _isSameConn(const ConnHandle& lhs, const ConnHandle& rhs)
+        {
+            return (lhs.id == rhs.id) && (lhs.generation == rhs.generation);
+        }
+
+        /* Coroutine mode: resume the coroutine waiting for the event, or start the handler on new input */
+        void _handleCoEvent(const ConnHandle& h, EventType type)
+        {
+            _CoSlot& slot = _coSlotOf(h.id);
+            std::coroutine_handle<>& waiter = (type == EventType::READ) ? slot.reader : slot.writer;
+            if (waiter && _isSameConn(slot.owner, h))
+            {
+                if ((type == EventType::WRITE) && slot.sendResult)
+                {
+                    Event ev;
+                    ev.id = h.id;
+                    ev.type = EventType::WRITE;
+                    ev.generation = h.generation;
+                    long result;
+                    if (!_multiplexer->takeSent(ev, result))
+                    {
+                        return;
+                    }
+                    if (result < 0)
+                    {
+                        (*_connections.get(h))->_peerClosed = true;
+                    }
+                    *std::exchange(slot.sendResult, nullptr) = result;
+                }
+                std::exchange(waiter, nullptr).resume();
+            }
+            else if (!slot.owner && (type == EventType::READ))
+            {
+                _startCoHandler(h);
+            }
+        }
+
+        void _startCoHandler(const ConnHandle& h)
+        {
+            const CltPtrType* cltPtr = _connections.get(h);
+            if (cltPtr)
+            {
+                _coSlotOf(h.id).owner = h;
+                _runCoHandler(h, *cltPtr).detach();
+            }
+        }
+
+        /* The handler owns the connection while it runs, an exception breaks the connection */
+        Task<> _runCoHandler(ConnHandle h, CltPtrType cltPtr)
+        {
+            bool broken = false;
+            try
+            {
+                co_await _coHandler(AsyncSocket<SocketType>(this, h, cltPtr));
+            }
+            catch (...)
+            {
+                _coDetail::logException(std::current_exception());
+                broken = true;
+            }
+            _finishCoHandler(h, cltPtr, broken);
+        }
+
+        /* The handler returned: close the connection, or wait for the next input */
+        void _finishCoHandler(const ConnHandle& h, const CltPtrType& cltPtr, bool broken)
+        {
+            _CoSlot& slot = _coSlotOf(h.id);
+            if (!_isSameConn(slot.owner, h))
+            {
+                /* Closed while the handler ran */
+                return;
+            }
+            slot.owner = ConnHandle();
+            if (broken || cltPtr->isPeerClosed())
+            {
+                _closeConnection(h);
+                return;
+            }
+            Event ev;
+            ev.id = h.id;
+            ev.type = EventType::READ;
+            ev.generation = h.generation;
+            /* Rearming makes the kernel report input the handler left unread, what a completion
+             * backend has received already is not reported again
+             */
+            _multiplexer->rearmEvent(ev);
+            if (_multiplexer->hasReceived(ev))
+            {
+                queueInLoop([this, h]()->void
+                {
+                    if (!_coSlotOf(h.id).owner)
+                    {
+                        _startCoHandler(h);
+                    }
+                });
+            }
+        }
+
+        bool _coAlive(const ConnHandle& h) const override
+        {
+            return _connections.get(h) != nullptr;
+        }
+
+        bool _coWaitIo(const ConnHandle& h, EventType type, std::coroutine_handle<> co) override
+        {
+            if (!_connections.get(h))
+            {
+                return false;
+            }
+            _CoSlot& slot = _coSlotOf(h.id);
+            ((type == EventType::READ) ? slot.reader : slot.writer) = co;
+            Event ev;
+            ev.id = h.id;
+            ev.type = type;
+            ev.generation = h.generation;
+            _multiplexer->rearmEvent(ev);
+            return true;
+        }
+
+        bool _coRecv(const ConnHandle& h, Buffer& buffer, long& n) override
+        {
+            Event ev;
+            ev.id = h.id;
+            ev.type = EventType::READ;
+            ev.generation = h.generation;
+            const CltPtrType* cltPtr = _connections.get(h);
+            if (!cltPtr || !_multiplexer->takeReceived(ev, buffer, n))
+            {
+                return false;
+            }
+            _checkReceived(*cltPtr, n);
+            return true;
+        }
+
+        bool _coRecv(const ConnHandle& h, char* buf, std::size_t length, long& n) override
+        {
+            Event ev;
+            ev.id = h.id;
+            ev.type = EventType::READ;
+            ev.generation = h.generation;
+            const CltPtrType* cltPtr = _connections.get(h);
+            if (!cltPtr || !_multiplexer->takeReceived(ev, buf, length, n))
+            {
+                return false;
+            }
+            _checkReceived(*cltPtr, n);
+            return true;
+        }
+
+        /* What recvSome records on the socket for the same result */
+        static void _checkReceived(const CltPtrType& cltPtr, long n)
+        {
+            if ((n == 0) || ((n < 0) && (errno != EAGAIN)))
+            {
+                cltPtr->_peerClosed = true;
+            }
+        }
+
+        bool _coSend(const ConnHandle& h, const ChunkQueue& queue, long& result, std::coroutine_handle<> co) override
+        {
+            /* Zero-copy sends need the socket's own pinning and error queue */
+            if (_zeroCopyThreshold || !_connections.get(h))
+            {
+                return false;
+            }
+            Event ev;
+            ev.id = h.id;
+            ev.type = EventType::WRITE;
+            ev.generation = h.generation;
+            if (!_multiplexer->submitSend(ev, queue))
+            {
+                return false;
+            }
+            _CoSlot& slot = _coSlotOf(h.id);
+            slot.writer = co;
+            slot.sendResult = &result;
+            return true;
+        }
+
+        void _coSleep(std::coroutine_handle<> co, std::chrono::milliseconds delay) override
+        {
+            _sleepTimers.add(co, delay);
+        }
+
+        /* The buffer is a local of the coroutine, out of reach once it is suspended: release it
+         * now under either policy
+         */
+        void _coBufferIdle(Buffer& buffer) override
+        {
+            if (_releaseOnDrain || (_releaseIdle.count() > 0))
+            {
+                _reclaim(buffer.shrink());
+            }
+        }
+
+        bool _coOffload(std::function<void()>& work, std::exception_ptr& error, std::coroutine_handle<> co) override
+        {
+            if (!_threadPool)
+            {
+                return false;
+            }
+            /* error lives in the suspended coroutine frame, nothing else touches it until the resume */
+            _threadPool->addTask([this, work = std::move(work), &error, co]()->void
+            {
+                try
+                {
+                    work();
+                }
+                catch (...)
+                {
+                    error = std::current_exception();
+                }
+                queueInLoop([co]()->void { co.resume(); });
+            });
+            return true;
+        }
+
+        /* Release a connection closed by peer or by error, stale handles are ignored */
+        void _closeConnection(const ConnHandle& h)
+        {
+            if (!_connections.erase(h))
+            {
+                return;
+            }
+            --_connNum;
+            _releaseAdmission();
+            if (static_cast<std::size_t>(h.id) < _connTimers.size())
+            {
+                _timer.cancel(_connTimers[h.id]);
+            }
+            _disarmRelease(h);
+            /* A pending io_uring poll would keep the file open after close */
+            Event ev;
+            ev.id = h.id;
+            ev.type = EventType::READ;
+            ev.generation = h.generation;
+            _multiplexer->releaseFd(ev);
+            ::close(h.id);
+            /* Suspended coroutines find the connection gone and unwind */
+            if (static_cast<std::size_t>(h.id) < _coSlots.size() && _isSameConn(_coSlots[h.id].owner, h))
+            {
+                _CoSlot slot = std::exchange(_coSlots[h.id], _CoSlot());
+                if (slot.reader)
+                {
+                    slot.reader.resume();
+                }
+                if (slot.writer)
+                {
+                    slot.writer.resume();
+                }
+            }
+        }
+
+        /* Hand a connection to this loop from another thread */
+        void _queueConnection(CltPtrType cltPtr)
+        {
+            ++_queuedNum;
+            queueInLoop([this, cltPtr]()->void
+            {
+                _addConnection(cltPtr);
+                --_queuedNum;
+            });
+        }
+
+        /* Any thread: connections served here plus those on their way, what a dispatcher balances on */
+        std::size_t _load() const
+        {
+            return _connNum + _queuedNum;
+        }
+
+        /* Reset the wakeup eventfd, the tasks run at the end of the iteration */
+        void _handleWakeup()
+        {
+            std::uint64_t cnt = 0;
+            ::read(_wakeupFd, &cnt, sizeof(cnt));
+        }
+
+        /* Run the tasks posted before this call, tasks they post run in the next iteration */
+        void _runPendingTasks()
+        {
+            _pendingTasks.consumeAll([](std::function<void()>& task)->void
+            {
+                task();
+            });
+        }
+
+        /* The handler which owned the connection is done: close it, or arm it again
+         * for what it waits for next. With one-shot events nobody else touches the
+         * connection until this point.
+         */
+        void _releaseConnection(const ConnHandle& h, const CltPtrType& cltPtr, EventType armedType)
+        {
+            if (cltPtr->isPeerClosed())
+            {
+                runInLoop([this, h]()->void { _closeConnection(h); });
+                return;
+            }
+            Event ev;
+            ev.id = h.id;
+            ev.generation = h.generation;
+            ev.type = cltPtr->isSendAll() ? EventType::READ : EventType::WRITE;
+            if ((ev.type == EventType::READ) && (cltPtr->isRecvPaused() || (cltPtr->bufferedBytes() > 0)))
+            {
+                runInLoop([this, h]()->void { _feedBuffered(h); });
+                return;
+            }
+            cltPtr->_fedBytes = SIZE_MAX;
+            if ((ev.type == EventType::READ) && _releaseOnDrain)
+            {
+                /* Nothing is buffered either way, the next request borrows a block again */
+                _reclaim(cltPtr->releaseIdleMemory());
+            }
+            bool rearm = _poolSize || (ev.type != armedType) || cltPtr->_readDisarmed;
+            bool armRelease = (ev.type == EventType::READ) && (_releaseIdle.count() > 0);
+            cltPtr->_readDisarmed = false;
+            if (rearm || armRelease)
+            {
+                /* The multiplexer and the timers are only touched by the loop thread,
+                 * the release timer is set before an event can hand the connection out again
+                 */
+                runInLoop([this, h, ev, rearm, armRelease]()->void
+                {
+                    _setWorkerOwner(h, false);
+                    if (armRelease)
+                    {
+                        _armRelease(h);
+                    }
+                    if (rearm)
+                    {
+                        _multiplexer->rearmEvent(ev);
+                    }
+                });
+            }
+        }
+
+        /* Loop thread: the read handler left input in the socket's buffer, which no edge will
+         * report again; run it once more on the buffered bytes. A connection at its receive cap
+         * is not watched for input meanwhile, so the kernel buffer fills and the TCP window closes
+         * on the peer, until the handler has consumed below the resume mark.
+         */
+        void _feedBuffered(const ConnHandle& h)
+        {
+            _setWorkerOwner(h, false);
+            const CltPtrType* cltPtr = _connections.get(h);
+            if (!cltPtr)
+            {
+                return;
+            }
+            const CltPtrType& clt = *cltPtr;
+            Event ev;
+            ev.id = h.id;
+            ev.generation = h.generation;
+            ev.type = EventType::READ;
+            std::size_t buffered = clt->bufferedBytes();
+            if (buffered == clt->_fedBytes)
+            {
+                /* The handler took nothing last round, it waits for more input */
+                clt->_fedBytes = SIZE_MAX;
+                if (_poolSize || clt->_readDisarmed)
+                {
+                    clt->_readDisarmed = false;
+                    _multiplexer->rearmEvent(ev);
+                }
+                return;
+            }
+            clt->_fedBytes = buffered;
+            if (clt->isRecvPaused() && !clt->_readDisarmed)
+            {
+                if (!_poolSize)
+                {
+                    /* A one-shot interest is already disarmed by its event */
+                    _multiplexer->unregistEvent(ev);
+                }
+                clt->_readDisarmed = true;
+            }
+            else if (!clt->isRecvPaused() && clt->_readDisarmed && !_poolSize)
+            {
+                /* Below the resume mark, new input may wake the handler again */
+                clt->_readDisarmed = false;
+                _multiplexer->rearmEvent(ev);
+            }
+            /* A one-shot interest stays disarmed until the buffer is drained, the handler runs once at a time */
+            queueInLoop([this, ev]()->void
+            {
+                Event again = ev;
+                _handleEvent(again);
+            });
+        }
+
+        /* A connection admitted by the owner went away, resume accepting below the low-water mark */
+        void _releaseAdmission()
+        {
+            EventLoop* owner = _admissionOwner;
+            std::size_t num = --owner->_admittedNum;
+            if (owner->_acceptPaused && (num <= owner->_lowWater))
+            {
+                owner->runInLoop([owner]()->void { owner->_resumeAccept(); });
+            }
+        }
+
+        /* Loop thread: stop watching the listener, new connections wait in the backlog.
+         * A completion backend cancels its accept, what it took meanwhile waits for the resume.
+         */
+        void _pauseAccept()
+        {
+            if (_acceptPaused.exchange(true))
+            {
+                return;
+            }
+            LOGNOTICE() << "Connections reach " << _highWater << ", accepting paused" << std::endl;
+            Event ev;
+            ev.id = socket._id;
+            ev.type = EventType::LISTEN;
+            _multiplexer->unregistEvent(ev);
+        }
+
+        /* Loop thread: watch the listener again and take what queued up meanwhile */
+        void _resumeAccept()
+        {
+            if ((_admittedNum > _lowWater) || !_acceptPaused.exchange(false))
+            {
+                return;
+            }
+            LOGNOTICE() << "Connections drop to " << _admittedNum << ", accepting resumed" << std::endl;
+            Event ev;
+            ev.id = socket._id;
+            ev.type = EventType::LISTEN;
+            _multiplexer->registEvent(ev);
+            /* The edge was consumed while paused, a cached re-registration reports nothing */
+            _doAccept();
+        }
+
+        /* Over the high-water mark: answer with the canned response and close */
+        void _rejectConnection(const CltPtrType& cltPtr)
+        {
+            ++_rejectedNum;
+            if (!_rejectResponse.empty())
+            {
+                ::send(cltPtr->_id, _rejectResponse.data(), _rejectResponse.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            }
+            cltPtr->disconnect();
+        }
+
+        /* Loop thread: whether REJECT refuses the next connection, with the same hysteresis as the pause */
+        bool _isRejecting()
+        {
+            std::size_t num = _admittedNum;
+            if (!_rejecting && (num >= _highWater))
+            {
+                _rejecting = true;
+                LOGNOTICE() << "Connections reach " << _highWater << ", rejecting new ones" << std::endl;
+            }
+            else if (_rejecting && (num <= _lowWater))
+            {
+                _rejecting = false;
+                LOGNOTICE() << "Connections drop to " << num << ", admitting again" << std::endl;
+            }
+            return _rejecting;
+        }
+
+        /* Serve a new connection here or hand it to another loop, unless admission control refuses it */
+        void _onAccepted(CltPtrType cltPtr)
+        {
+            if (_highWater && (_overloadPolicy == OverloadPolicy::REJECT) && _isRejecting())
+            {
+                _rejectConnection(cltPtr);
+                return;
+            }
+            if ((++_admittedNum >= _highWater) && _highWater && (_overloadPolicy == OverloadPolicy::PAUSE_ACCEPT))
+            {
+                _pauseAccept();
+            }
+            if (_acceptDispatcher)
+            {
+                _acceptDispatcher(cltPtr);
             }
             else
             {
+                _addConnection(cltPtr);
+            }
+        }
+
+        /* Out of fds: accept the head of the backlog with the reserve fd and close it at once,
+         * the peer gets a reset instead of hanging in the queue
+         */
+        bool _shedConnection()
+        {
+            if (-1 == _reserveFd)
+            {
+                return false;
+            }
+            ::close(_reserveFd);
+            int clientfd = ::accept(socket._id, nullptr, nullptr);
+            if (-1 != clientfd)
+            {
+                ::close(clientfd);
+            }
+            _reserveFd = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+            LOGWARN() << "Out of file descriptors, connection dropped" << std::endl;
+            return -1 != clientfd;
+        }
+
+        /* Do Accept, until the backlog is drained or the budget of this iteration is spent */
+        void _doAccept()
+        {
+            /* Completion based backends have accepted already; a pause leaves the rest with the
+             * backend until the resume takes them
+             */
+            int clientfd;
+            bool acceptedByBackend = false;
+            for (std::uint32_t n = 0; !_acceptPaused && _multiplexer->takeAccepted(clientfd); ++n)
+            {
+                acceptedByBackend = true;
+                _onAccepted(socket.adopt(clientfd));
+                if (n + 1 == _acceptBudget)
+                {
+                    queueInLoop([this]()->void { _doAccept(); });
+                    return;
+                }
+            }
+            if (acceptedByBackend || _acceptPaused)
+            {
+                return;
+            }
+            for (std::uint32_t n = 0; n < _acceptBudget; ++n)
+            {
+                if (_acceptPaused)
+                {
+                    return;
+                }
+                CltPtrType cltPtr = socket.accept();
+                if (cltPtr)
+                {
+                    _onAccepted(cltPtr);
+                    continue;
+                }
+                if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                {
+                    return;
+                }
+                if ((errno == EINTR) || (errno == ECONNABORTED))
+                {
+                    continue;
+                }
+                if (((errno == EMFILE) || (errno == ENFILE)) && _shedConnection())
+                {
+                    continue;
+                }
                 LOGWARN() << "Accept failed, " << ::strerror(errno) << std::endl;
+                return;
+            }
+            /* The listen fd is edge triggered, nobody reports the rest again: go on next iteration */
+            queueInLoop([this]()->void { _doAccept(); });
+        }
+
+        /* Loop thread: EPOLLERR alone means zero-copy completions, or a broken connection.
+         * The connection is not owned by a handler while its event is armed.
+         */
+        void _handleErrQueue(const ConnHandle& h)
+        {
+            const CltPtrType* cltPtr = _connections.get(h);
+            if (!cltPtr)
+            {
+                return;
+            }
+            if (!(*cltPtr)->reapZeroCopy())
+            {
+                _closeConnection(h);
+                return;
+            }
+            if (_poolSize)
+            {
+                /* The one-shot event fired for the error queue, arm what the connection waits for */
+                bool waitsWrite = _coHandler ? static_cast<bool>(_coSlotOf(h.id).writer) : !(*cltPtr)->isSendAll();
+                Event ev;
+                ev.id = h.id;
+                ev.type = waitsWrite ? EventType::WRITE : EventType::READ;
+                ev.generation = h.generation;
+                _multiplexer->rearmEvent(ev);
             }
         }
 
+        /* Completions which came with a read or write readiness are not reported again */
+        void _reapZeroCopy(const ConnHandle& h)
+        {
+            const CltPtrType* cltPtr = _connections.get(h);
+            if (cltPtr && (*cltPtr)->isZeroCopyPending())
+            {
+                (*cltPtr)->reapZeroCopy();
+            }
+        }
+
+        static ConnHandle _handleOf(const Event& ev)
+        {
+            ConnHandle h;
+            h.id = ev.id;
+            h.generation = ev.generation;
+            return h;
+        }
+
         /* Event handler */
-        void _handleEvent(std::uint16_t timeoutMs, Event& ev)
+        void _handleEvent(Event& ev)
         {
             if (ev.type == EventType::LISTEN)
             {
@@ -87,89 +1011,97 @@ namespace jrNetWork
             }
             if (ev.type == EventType::READ)
             {
-                if (ev.id == _UnifiedEventSource::_uesfd[0])
+                if (_handleSignals && (ev.id == _UnifiedEventSource::_signalFd))
                 {
-                    ev.type == EventType::SIGNAL;
+                    ev.type = EventType::SIGNAL;
                 }
-                else
+                else if (ev.id == _wakeupFd)
                 {
-                    _threadPool.addTask([this, ev]()->void
+                    _handleWakeup();
+                }
+                else if (_coHandler && _connections.get(_handleOf(ev)))
+                {
+                    _reapZeroCopy(_handleOf(ev));
+                    _refreshIdleTimer(_handleOf(ev));
+                    _handleCoEvent(_handleOf(ev), EventType::READ);
+                }
+                else if (_connections.get(_handleOf(ev)))
+                {
+                    // The handler owns the connection until it is released
+                    ConnHandle h = _handleOf(ev);
+                    _reapZeroCopy(h);
+                    _refreshIdleTimer(h);
+                    _disarmRelease(h);
+                    _setWorkerOwner(h, static_cast<bool>(_threadPool));
+                    _dispatch([this, h]()->void
                     {
+                        const CltPtrType* cltPtr = _connections.get(h);
+                        if (!cltPtr)
+                        {
+                            return;
+                        }
                         // Execute user-specified logic
-                        _readEvHandler(_idSocketTbl[ev.id]);
-                        // If the data has not been sent at one time,
-                        // it will be pushed into the buffer (completed by TCP::Socket),
-                        // and then register the EPOLLOUT event to wait for the next sending.
-                        if (!_idSocketTbl[ev.id]->isSendAll())
+                        if (_readEvHandler)
                         {
-                            Event writeEv;
-                            writeEv.id = ev.id;
-                            writeEv.type = EventType::WRITE;
-                            _multiplexer->registEvent(writeEv);
+                            _readEvHandler(*cltPtr);
                         }
+                        // If the data has not been sent at one time,
+                        // it will be pushed into the buffer (completed by TCP::Socket),
+                        // and the connection waits for EPOLLOUT instead of EPOLLIN.
+                        _releaseConnection(h, *cltPtr, EventType::READ);
                     });
                 }
             }
-            if (ev.type == EventType::WRITE)
+            if ((ev.type == EventType::WRITE) && _coHandler && _connections.get(_handleOf(ev)))
+            {
+                _reapZeroCopy(_handleOf(ev));
+                _handleCoEvent(_handleOf(ev), EventType::WRITE);
+            }
+            else if ((ev.type == EventType::WRITE) && _connections.get(_handleOf(ev)))
             {
-                _threadPool.addTask([this, ev]()->void
+                ConnHandle h = _handleOf(ev);
+                _reapZeroCopy(h);
+                _disarmRelease(h);
+                _setWorkerOwner(h, static_cast<bool>(_threadPool));
+                _dispatch([this, h]()->void
                 {
+                    const CltPtrType* cltPtr = _connections.get(h);
+                    if (!cltPtr)
+                    {
+                        return;
+                    }
                     // Send rest data in buf
-                    if (_sendRestBuf(_idSocketTbl[ev.id]))
+                    if (_sendRestBuf(*cltPtr) && _writeEvHandler)
                     {
                         // When all sended, execute user-specified logic
-                        _writeEvHandler(_idSocketTbl[ev.id]);
+                        _writeEvHandler(*cltPtr);
                     }
+                    _releaseConnection(h, *cltPtr, EventType::WRITE);
                 });
             }
             if (ev.type == EventType::ConnClosed)
             {
-                ::close(ev.id);
+                _closeConnection(_handleOf(ev));
             }
-            if (ev.type == EventType::SIGNAL)
+            if (ev.type == EventType::ErrQueue)
             {
-                if (_UnifiedEventSource::handleSignals(_sigHandlerTbl))
-                {
-                    ev.type = EventType::Timeout;
-                }
+                _handleErrQueue(_handleOf(ev));
             }
-            if (ev.type == EventType::Timeout)
+            if (ev.type == EventType::SIGNAL)
             {
-                _threadPool.addTask([this, ev]()->void
-                {
-                    // Update the timer container, handle timeout clients
-                    _timer.tick(_timeoutCallback);  
-                });
+                _UnifiedEventSource::handleSignals(_sigHandlerTbl);
             }
         }
 
-        /* Send data in buffer */
-        bool _sendRestBuf(CltPtrType cltPtr)
+        /* Send data in buffer, return true when all sent */
+        bool _sendRestBuf(const CltPtrType& cltPtr)
         {
             if (!cltPtr->isSendAll())
             {
-                /* Send data in buffer */
-                std::string pre_data = cltPtr->_sendBuffer.getData();
-                uint pre_sent_size = cltPtr->send(pre_data);
-                /* A part is sent, and the rest is restored to the buffer */
-                if (pre_sent_size < pre_data.length())
-                {
-                    cltPtr->_sendBuffer.append(pre_data.begin(), pre_data.end());
-                    return false;
-                }
-                else
-                {
-                    Event writeEv;
-                    writeEv.id = cltPtr->_id;
-                    writeEv.type = EventType::WRITE;
-                    _multiplexer->unregistEvent(writeEv);
-                    return true;
-                }
-            }
-            else
-            {
-                return true;
+                /* What the socket does not take stays queued */
+                cltPtr->flush();
             }
+            return cltPtr->isSendAll();
         }
 
         /* Handler set helper */
@@ -177,7 +1109,7 @@ namespace jrNetWork
         IOCallbackType _handlerSetHelper(F&& handler, Args&&... args)
         {
             auto handlerBinder = std::bind(std::forward<F>(handler), std::forward<Args>(args)..., std::placeholders::_1);
-            return [handlerBinder](CltPtrType cltPtr)->void
+            return [handlerBinder](const CltPtrType& cltPtr)->void
             {
                 if (cltPtr)
                 {
@@ -187,19 +1119,220 @@ namespace jrNetWork
         }
 
     public:
-        /* Init thread pool and IO model */
-        EventLoop(std::uint16_t port, std::uint16_t maxPoolSize = std::thread::hardware_concurrency())
-            : _multiplexer(std::make_unique<Epoll::Multiplexer>())
-            , _threadPool(maxPoolSize)
+        /* Init thread pool and IO model, maxPoolSize 0 handles all events on the loop thread */
+        EventLoop(std::uint16_t port, std::uint16_t maxPoolSize = std::thread::hardware_concurrency(),
+                  MultiplexerType multiplexerType = MultiplexerType::EPOLL)
+            : _port(port)
+            , _multiplexer(createMultiplexer(multiplexerType))
+            , _wakeupFd(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+            , _poolSize(maxPoolSize)
         {
-            _socketInit(port);
-            _UnifiedEventSource::bindSignal(SIGALRM);
+            if (-1 == _wakeupFd)
+            {
+                LOGFATAL() << "Wakeup eventfd create failed, " << ::strerror(errno) << std::endl;
+            }
+            /* Connections are owned by one worker at a time: armed one-shot, given back when handled */
+            _multiplexer->setOneShot(_poolSize > 0);
+            Event ev;
+            ev.id = _wakeupFd;
+            ev.type = EventType::WAKEUP;
+            _multiplexer->registEvent(ev);
         }
 
         /* Release connection resources */
         ~EventLoop()
         {
             socket.disconnect();
+            ::close(_wakeupFd);
+            if (-1 != _reserveFd)
+            {
+                ::close(_reserveFd);
+            }
+        }
+
+        /* Check if the caller runs on the loop thread */
+        bool isInLoopThread() const
+        {
+            return std::this_thread::get_id() == _loopThreadId.load(std::memory_order_acquire);
+        }
+
+        /* Run task on the loop thread: at once when called there, otherwise queued */
+        void runInLoop(std::function<void()> task)
+        {
+            if (isInLoopThread())
+            {
+                task();
+            }
+            else
+            {
+                queueInLoop(std::move(task));
+            }
+        }
+
+        /* Queue task from any thread, it runs on the loop thread after the events of the
+         * current iteration. Only the first task of a batch wakes the loop up.
+         */
+        void queueInLoop(std::function<void()> task)
+        {
+            if (!_pendingTasks.push(std::move(task)) || isInLoopThread())
+            {
+                return;
+            }
+            std::uint64_t one = 1;
+            if (-1 == ::write(_wakeupFd, &one, sizeof(one)))
+            {
+                LOGWARN() << "Wakeup loop failed, " << ::strerror(errno) << std::endl;
+            }
+        }
+
+        /* Number of connections served by this loop, readable from any thread */
+        std::size_t connectionNum() const
+        {
+            return _connNum;
+        }
+
+        /* Let several loops listen on the same port, the kernel spreads connections among them.
+         * Must be called before run.
+         */
+        void setReusePort(bool on)
+        {
+            _reusePort = on;
+        }
+
+        /* Low latency mode: spin on a non-blocking wait for budgetUs before blocking, and ask the
+         * kernel to busy poll accepted sockets. 0 turns it off. Must be called before run.
+         */
+        void setBusyPoll(std::uint32_t budgetUs)
+        {
+            _busyPollUs = budgetUs;
+            _multiplexer->setBusyPoll(budgetUs);
+        }
+
+        /* Options applied to the listener and to every connection, must be called before run */
+        void setSocketTuning(SocketTuning tuning)
+        {
+            _tuning = std::move(tuning);
+        }
+
+        /* Send chunks of at least threshold bytes with MSG_ZEROCOPY; their buffers are kept until
+         * the completions arrive on the error queue, which the loop reads as events. Pays off for
+         * large responses over real NICs only, the kernel copies on loopback anyway.
+         * 0 turns it off. Must be called before run.
+         */
+        void setZeroCopy(std::size_t threshold)
+        {
+            _zeroCopyThreshold = threshold;
+        }
+
+        /* Backpressure: when a connection has highWater bytes of output queued by send, the
+         * high-water handler is called so the producer can pause; the drained handler is called
+         * once flushing brings it down to lowWater. Handlers run where the send or flush happens,
+         * while the connection is owned there. highWater 0 (default) leaves the queue unbounded.
+         * Must be called before run.
+         */
+        void setSendWaterMarks(std::size_t highWater, std::size_t lowWater)
+        {
+            _sendHighWater = highWater;
+            _sendLowWater = lowWater;
+        }
+
+        /* Read-side flow control for read handlers: recv buffers at most limit bytes ahead of the
+         * handler. A connection which reaches it is not watched for input until its handler has
+         * consumed the buffered bytes below resumeBelow, meanwhile the kernel closes the TCP window.
+         * Coroutine handlers own their buffers and read only when they wait for input.
+         * limit 0 (default) leaves it unbounded. Must be called before run.
+         */
+        void setRecvLimit(std::size_t limit, std::size_t resumeBelow)
+        {
+            _recvLimit = limit;
+            _recvResume = resumeBelow;
+        }
+
+        /* Give the buffer memory of quiet connections back to the block pool: once a connection
+         * has waited idleAfter for input (0 for never), and with onDrain as soon as it has nothing
+         * buffered and nothing left to send. Coroutine handlers release an empty buffer when they
+         * wait for input under either setting. Off by default. Must be called before run.
+         */
+        void setBufferRelease(std::chrono::milliseconds idleAfter, bool onDrain = false)
+        {
+            _releaseIdle = idleAfter;
+            _releaseOnDrain = onDrain;
+        }
+
+        /* Bytes of buffer memory given back by the release policy, and how many buffers */
+        std::uint64_t reclaimedBytes() const
+        {
+            return _reclaimedBytes;
+        }
+
+        std::uint64_t reclaimedBuffers() const
+        {
+            return _reclaimedBuffers;
+        }
+
+        /* Waits which found events while spinning / which had to block, to tune the budget */
+        std::uint64_t spinWakeups() const
+        {
+            return _multiplexer->spinWakeups();
+        }
+
+        std::uint64_t blockingWaits() const
+        {
+            return _multiplexer->blockingWaits();
+        }
+
+        /* Admission control: at highWater connections the loop pauses accepting or rejects new
+         * connections with rejectResponse (closed without a response when empty), and it accepts
+         * again once the count drops to lowWater. highWater 0 admits everything. Must be called before run.
+         */
+        void setMaxConnections(std::size_t highWater, std::size_t lowWater,
+                               OverloadPolicy policy = OverloadPolicy::PAUSE_ACCEPT,
+                               std::string rejectResponse = "")
+        {
+            _highWater = highWater;
+            _lowWater = std::min(lowWater, highWater ? highWater - 1 : 0);
+            _overloadPolicy = policy;
+            _rejectResponse = std::move(rejectResponse);
+        }
+
+        /* Connections admitted and not closed yet, for an acceptor those served by its sub-loops */
+        std::size_t admittedNum() const
+        {
+            return _admittedNum;
+        }
+
+        /* Connections refused by the REJECT policy */
+        std::uint64_t rejectedNum() const
+        {
+            return _rejectedNum;
+        }
+
+        bool isAcceptPaused() const
+        {
+            return _acceptPaused;
+        }
+
+        /* Pin the loop thread on loopCpu and the pool workers on workerCpus (default: the CPUs of
+         * the loop's NUMA node). With numaLocal the loop, and the workers it spawns, allocate from
+         * their local node. Must be called before run.
+         */
+        void setPlacement(int loopCpu, std::vector<int> workerCpus = {}, bool numaLocal = true)
+        {
+            _loopCpu = loopCpu;
+            _workerCpus = std::move(workerCpus);
+            _numaLocal = numaLocal;
+        }
+
+        /* Listen backlog, must be called before run */
+        void setBacklog(int backlog)
+        {
+            _backlog = backlog;
+        }
+
+        /* Connections accepted per listen event before the other events get their turn */
+        void setAcceptBudget(std::uint32_t budget)
+        {
+            _acceptBudget = budget ? budget : 1;
         }
 
         /* Set event handler */
@@ -215,6 +1348,34 @@ namespace jrNetWork
             this->_writeEvHandler = this->_handlerSetHelper(std::forward<F>(handler), std::forward<Args>(args)...);
         }
 
+        template<typename F, typename... Args>
+        void setHighWaterHandler(F&& handler, Args&&... args)
+        {
+            this->_highWaterHandler = this->_handlerSetHelper(std::forward<F>(handler), std::forward<Args>(args)...);
+        }
+
+        template<typename F, typename... Args>
+        void setDrainedHandler(F&& handler, Args&&... args)
+        {
+            this->_drainedHandler = this->_handlerSetHelper(std::forward<F>(handler), std::forward<Args>(args)...);
+        }
+
+        /* Serve connections with coroutines: handler(args..., AsyncSocket) returns a Task<>.
+         * It is started on the loop thread when a connection has input and no handler runs
+         * for it, and owns the connection until it returns; then the connection is closed if
+         * it broke, otherwise the next input starts the handler again.
+         * Replaces the read and write handlers.
+         */
+        template<typename F, typename... Args>
+        void setCoroutineHandler(F&& handler, Args&&... args)
+        {
+            auto handlerBinder = std::bind(std::forward<F>(handler), std::forward<Args>(args)..., std::placeholders::_1);
+            _coHandler = [handlerBinder](AsyncSocket<SocketType> sock)->Task<>
+            {
+                return handlerBinder(std::move(sock));
+            };
+        }
+
         template<typename F, typename... Args>
         void setSignalEventHandler(int sig, F&& handler, Args&&... args)
         {
@@ -226,24 +1387,44 @@ namespace jrNetWork
             };
         }
 
+        /* Called on the loop thread for a connection idle for the run() timeout, never while a
+         * handler owns it. Calling disconnect or shutdown on the socket closes the connection.
+         */
         template<typename F, typename... Args>
         void setTimeoutEventHandler(F&& handler, Args&&... args)
         {
             this->_timeoutCallback = this->_handlerSetHelper(std::forward<F>(handler), std::forward<Args>(args)...);
         }
 
-        /* Do Event Loop */
-        int run(std::uint16_t timeoutMs)
+        /* Do Event Loop, idleTimeout is the idle timeout of connections (0 for none) */
+        int run(std::chrono::milliseconds idleTimeout)
         {
             bool stop = false;
-            _timer.startCount(timeoutMs);
+            _loopThreadId.store(std::this_thread::get_id(), std::memory_order_release);
+            _CoScheduler::current = this;
+            _applyPlacement();
+            if (_port != 0)
+            {
+                _socketInit(_port);
+            }
+            if (_handleSignals)
+            {
+                Event ev;
+                ev.id = _UnifiedEventSource::_signalFd;
+                ev.type = EventType::SIGNAL;
+                _multiplexer->registEvent(ev);
+            }
+            _idleTimeout = idleTimeout;
             while(!stop)
             {
-                _multiplexer->wait();
+                /* Sleep until the earliest timer deadline, timers expire here on the loop thread */
+                _multiplexer->wait(_pendingTasks.empty() ? _nextTimeout() : 0);
                 for (auto cit = _multiplexer->begin(); cit != _multiplexer->end(); ++cit)
                 {
-                    _handleEvent(timeoutMs, *cit);
+                    _handleEvent(*cit);
                 }
+                _runPendingTasks();
+                _expireTimers();
             }
             return 0;
         }
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cstdint>
+#include "EventLoop.h"
+#include "Placement.h"
+#include "Log.h"
+
+namespace jrNetWork
+{
+    /* How a multi-reactor group spreads connections among its loops */
+    enum class ReactorMode
+    {
+        REUSEPORT,  // Every loop listens, the kernel hashes connections among them
+        ACCEPTOR    // A dedicated acceptor loop hands accepted sockets to the sub-loops
+    };
+
+    /* How the acceptor chooses a sub-loop */
+    enum class BalancePolicy
+    {
+        ROUND_ROBIN,
+        LEAST_CONNECTIONS
+    };
+
+    /* Group of event loops.
+     * With one loop it is the classic single reactor + thread pool.
+     * With several loops it runs one loop per thread: every loop owns its multiplexer,
+     * timer and connection table, handles its events inline and is pinned on its own CPU.
+     * In REUSEPORT mode every loop has its own SO_REUSEPORT listen socket; in ACCEPTOR mode
+     * loop 0 only accepts and wakes the chosen sub-loop through its eventfd.
+     */
+    template<class SocketType>
+    class EventLoopGroup
+    {
+    private:
+        using LoopType = EventLoop<SocketType>;
+
+    private:
+        std::vector<std::unique_ptr<LoopType> > _loops;
+        std::vector<std::thread> _threads;
+        ReactorMode _mode;
+        BalancePolicy _policy = BalancePolicy::ROUND_ROBIN;
+        PlacementPolicy _placement;
+        /* Next sub-loop of round robin, only used by the acceptor thread */
+        std::size_t _nextLoop = 0;
+
+        /* Acceptor: pass a new connection to a sub-loop */
+        void _dispatchConnection(std::shared_ptr<SocketType> cltPtr)
+        {
+            std::size_t target = 1;
+            if (_policy == BalancePolicy::ROUND_ROBIN)
+            {
+                target = 1 + (_nextLoop++ % (_loops.size() - 1));
+            }
+            else
+            {
+                for (std::size_t i = 2; i < _loops.size(); ++i)
+                {
+                    if (_loops[i]->_load() < _loops[target]->_load())
+                    {
+                        target = i;
+                    }
+                }
+            }
+            _loops[target]->_queueConnection(std::move(cltPtr));
+        }
+
+        /* Cpu of loop idx: from the policy, otherwise the (idx mod count)-th cpu the group may run on
+         * for multi-reactor groups
+         */
+        int _loopCpu(std::size_t idx) const
+        {
+            if (!_placement.loopCpus.empty())
+            {
+                return _placement.loopCpus[idx % _placement.loopCpus.size()];
+            }
+            if (_loops.size() == 1)
+            {
+                return -1;
+            }
+            std::vector<int> cpus = Placement::allowedCpus();
+            if (cpus.empty())
+            {
+                return -1;
+            }
+            return cpus[idx % cpus.size()];
+        }
+
+    public:
+        /* maxPoolSize only applies to a single loop, loops of a multi-reactor group have no pool.
+         * In ACCEPTOR mode loopNum is the number of sub-loops, the acceptor runs on an extra thread.
+         */
+        EventLoopGroup(std::uint16_t port, std::uint16_t loopNum = 1,
+                       std::uint16_t maxPoolSize = std::thread::hardware_concurrency(),
+                       ReactorMode mode = ReactorMode::REUSEPORT,
+                       MultiplexerType multiplexerType = MultiplexerType::EPOLL)
+            : _mode(loopNum > 1 ? mode : ReactorMode::REUSEPORT)
+        {
+            if (loopNum == 0)
+            {
+                loopNum = 1;
+            }
+            if (_mode == ReactorMode::ACCEPTOR)
+            {
+                _loops.emplace_back(std::make_unique<LoopType>(port, 0, multiplexerType));
+                _loops.back()->_acceptDispatcher = [this](std::shared_ptr<SocketType> cltPtr)->void
+                {
+                    _dispatchConnection(std::move(cltPtr));
+                };
+                for (std::uint16_t i = 0; i < loopNum; ++i)
+                {
+                    _loops.emplace_back(std::make_unique<LoopType>(0, 0, multiplexerType));
+                    _loops.back()->_handleSignals = false;
+                    /* Admission is counted by the acceptor */
+                    _loops.back()->_admissionOwner = _loops[0].get();
+                }
+                return;
+            }
+            for (std::uint16_t i = 0; i < loopNum; ++i)
+            {
+                _loops.emplace_back(std::make_unique<LoopType>(port, loopNum > 1 ? 0 : maxPoolSize, multiplexerType));
+                if (loopNum > 1)
+                {
+                    _loops.back()->setReusePort(true);
+                }
+                /* Signals are process-wide, the first loop reads them for everyone */
+                _loops.back()->_handleSignals = (i == 0);
+            }
+        }
+
+        ~EventLoopGroup()
+        {
+            for (auto& t : _threads)
+            {
+                if (t.joinable())
+                {
+                    t.join();
+                }
+            }
+        }
+
+        std::size_t size() const { return _loops.size(); }
+
+        /* Loop idx of the group, e.g. to post work onto it with runInLoop/queueInLoop */
+        LoopType& loop(std::size_t idx) { return *_loops[idx]; }
+
+        /* Sub-loop choice of ACCEPTOR mode, must be called before run */
+        void setBalancePolicy(BalancePolicy policy)
+        {
+            _policy = policy;
+        }
+
+        /* Thread placement of every loop and its pool, must be called before run */
+        void setPlacement(PlacementPolicy policy)
+        {
+            _placement = std::move(policy);
+        }
+
+        /* Admission control of the group, see EventLoop::setMaxConnections.
+         * The acceptor enforces the limits for all sub-loops, REUSEPORT loops get an equal share each.
+         */
+        void setMaxConnections(std::size_t highWater, std::size_t lowWater,
+                               OverloadPolicy policy = OverloadPolicy::PAUSE_ACCEPT,
+                               std::string rejectResponse = "")
+        {
+            if (_mode == ReactorMode::ACCEPTOR)
+            {
+                _loops[0]->setMaxConnections(highWater, lowWater, policy, std::move(rejectResponse));
+                return;
+            }
+            std::size_t n = _loops.size();
+            for (auto& loop : _loops)
+            {
+                loop->setMaxConnections((highWater + n - 1) / n, lowWater / n, policy, rejectResponse);
+            }
+        }
+
+        /* Connections served by all loops */
+        std::size_t connectionNum() const
+        {
+            std::size_t n = 0;
+            for (auto& loop : _loops)
+            {
+                n += loop->connectionNum();
+            }
+            return n;
+        }
+
+        /* Connections refused by the REJECT policy */
+        std::uint64_t rejectedNum() const
+        {
+            std::uint64_t n = 0;
+            for (auto& loop : _loops)
+            {
+                n += loop->rejectedNum();
+            }
+            return n;
+        }
+
+        /* Listen backlog of every listening loop */
+        void setBacklog(int backlog)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setBacklog(backlog);
+            }
+        }
+
+        /* Accept budget of every listening loop, see EventLoop::setAcceptBudget */
+        void setAcceptBudget(std::uint32_t budget)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setAcceptBudget(budget);
+            }
+        }
+
+        /* Busy poll budget of every loop, see EventLoop::setBusyPoll */
+        void setBusyPoll(std::uint32_t budgetUs)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setBusyPoll(budgetUs);
+            }
+        }
+
+        /* Socket options of every loop, see EventLoop::setSocketTuning */
+        void setSocketTuning(const SocketTuning& tuning)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setSocketTuning(tuning);
+            }
+        }
+
+        /* Zero-copy threshold of every loop, see EventLoop::setZeroCopy */
+        void setZeroCopy(std::size_t threshold)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setZeroCopy(threshold);
+            }
+        }
+
+        /* Send water marks of every loop, see EventLoop::setSendWaterMarks */
+        void setSendWaterMarks(std::size_t highWater, std::size_t lowWater)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setSendWaterMarks(highWater, lowWater);
+            }
+        }
+
+        /* Receive cap of every loop, see EventLoop::setRecvLimit */
+        void setRecvLimit(std::size_t limit, std::size_t resumeBelow)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setRecvLimit(limit, resumeBelow);
+            }
+        }
+
+        /* Buffer release policy of every loop, see EventLoop::setBufferRelease */
+        void setBufferRelease(std::chrono::milliseconds idleAfter, bool onDrain = false)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setBufferRelease(idleAfter, onDrain);
+            }
+        }
+
+        /* Reclaimed buffer memory summed over the loops */
+        std::uint64_t reclaimedBytes() const
+        {
+            std::uint64_t n = 0;
+            for (auto& loop : _loops)
+            {
+                n += loop->reclaimedBytes();
+            }
+            return n;
+        }
+
+        std::uint64_t reclaimedBuffers() const
+        {
+            std::uint64_t n = 0;
+            for (auto& loop : _loops)
+            {
+                n += loop->reclaimedBuffers();
+            }
+            return n;
+        }
+
+        /* Spin / block counters summed over the loops */
+        std::uint64_t spinWakeups() const
+        {
+            std::uint64_t n = 0;
+            for (auto& loop : _loops)
+            {
+                n += loop->spinWakeups();
+            }
+            return n;
+        }
+
+        std::uint64_t blockingWaits() const
+        {
+            std::uint64_t n = 0;
+            for (auto& loop : _loops)
+            {
+                n += loop->blockingWaits();
+            }
+            return n;
+        }
+
+        /* Set event handler of every loop */
+        template<typename F, typename... Args>
+        void setReadEventHandler(F&& handler, Args&&... args)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setReadEventHandler(handler, args...);
+            }
+        }
+
+        template<typename F, typename... Args>
+        void setWriteEventHandler(F&& handler, Args&&... args)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setWriteEventHandler(handler, args...);
+            }
+        }
+
+        template<typename F, typename... Args>
+        void setHighWaterHandler(F&& handler, Args&&... args)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setHighWaterHandler(handler, args...);
+            }
+        }
+
+        template<typename F, typename... Args>
+        void setDrainedHandler(F&& handler, Args&&... args)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setDrainedHandler(handler, args...);
+            }
+        }
+
+        template<typename F, typename... Args>
+        void setCoroutineHandler(F&& handler, Args&&... args)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setCoroutineHandler(handler, args...);
+            }
+        }
+
+        template<typename F, typename... Args>
+        void setSignalEventHandler(int sig, F&& handler, Args&&... args)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setSignalEventHandler(sig, handler, args...);
+            }
+        }
+
+        template<typename F, typename... Args>
+        void setTimeoutEventHandler(F&& handler, Args&&... args)
+        {
+            for (auto& loop : _loops)
+            {
+                loop->setTimeoutEventHandler(handler, args...);
+            }
+        }
+
+        /* Run loop 0 on the calling thread, the others on their own threads; each loop pins itself */
+        int run(std::chrono::milliseconds idleTimeout)
+        {
+            for (std::size_t i = 0; i < _loops.size(); ++i)
+            {
+                _loops[i]->setPlacement(_loopCpu(i), _placement.workerCpus, _placement.numaLocal);
+            }
+            for (std::size_t i = 1; i < _loops.size(); ++i)
+            {
+                LoopType* loop = _loops[i].get();
+                _threads.emplace_back([loop, idleTimeout]()->void { loop->run(idleTimeout); });
+            }
+            return _loops[0]->run(idleTimeout);
+        }
+
+    public:
+        /* Not allowed Operation */
+        EventLoopGroup(const EventLoopGroup&) = delete;
+        EventLoopGroup& operator=(const EventLoopGroup&) = delete;
+    };
+}
@@ -0,0 +1,155 @@
+#include "FileCache.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+
+namespace jrNetWork {
+    OpenFile::OpenFile(int fd, const struct stat& st)
+        : fd(fd)
+        , st(st)
+    {
+    }
+
+    OpenFile::~OpenFile()
+    {
+        ::close(fd);
+    }
+
+    FileCache::FileCache(std::size_t capacity, std::chrono::milliseconds revalidatePeriod)
+        : _capacity(capacity)
+        , _revalidatePeriod(revalidatePeriod)
+    {
+    }
+
+    FileCache::FilePtr FileCache::open(const std::string& path)
+    {
+        auto now = std::chrono::steady_clock::now();
+        FilePtr cached;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _entries.find(path);
+            if (it != _entries.end())
+            {
+                _lru.splice(_lru.begin(), _lru, it->second.lru);
+                if (now - it->second.checked < _revalidatePeriod)
+                {
+                    ++_hits;
+                    return it->second.file;
+                }
+                cached = it->second.file;
+            }
+        }
+        /* Syscalls are done outside the lock */
+        struct stat st;
+        if (cached && (0 == ::stat(path.c_str(), &st))
+            && (st.st_ino == cached->st.st_ino) && (st.st_dev == cached->st.st_dev)
+            && (st.st_size == cached->st.st_size) && (st.st_mtim.tv_sec == cached->st.st_mtim.tv_sec)
+            && (st.st_mtim.tv_nsec == cached->st.st_mtim.tv_nsec))
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            auto it = _entries.find(path);
+            if ((it != _entries.end()) && (it->second.file == cached))
+            {
+                it->second.checked = now;
+            }
+            ++_hits;
+            return cached;
+        }
+        ++_misses;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        FilePtr file;
+        if (-1 != fd)
+        {
+            if ((0 == ::fstat(fd, &st)) && S_ISREG(st.st_mode))
+            {
+                auto opened = std::make_shared<OpenFile>(fd, st);
+                if ((opened->size() > 0) && (opened->size() <= _maxContentBytes))
+                {
+                    opened->content = _load(*opened);
+                }
+                file = std::move(opened);
+            }
+            else
+            {
+                ::close(fd);
+            }
+        }
+        _insert(path, file);
+        return file;
+    }
+
+    Slice FileCache::_load(const OpenFile& file)
+    {
+        std::string data(file.size(), '\0');
+        std::size_t done = 0;
+        while (done < data.size())
+        {
+            ssize_t n = ::pread(file.fd, &data[done], data.size() - done, static_cast<off_t>(done));
+            if ((n < 0) && (errno == EINTR))
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                /* Truncated or unreadable meanwhile, the file is sent from its fd */
+                return Slice();
+            }
+            done += static_cast<std::size_t>(n);
+        }
+        return Slice(std::move(data));
+    }
+
+    void FileCache::_insert(const std::string& path, FilePtr file)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _entries.find(path);
+        if (it != _entries.end())
+        {
+            _lru.erase(it->second.lru);
+            _entries.erase(it);
+        }
+        if (!file || (_capacity == 0))
+        {
+            return;
+        }
+        _lru.push_front(path);
+        _entries[path] = _Entry{std::move(file), _lru.begin(), std::chrono::steady_clock::now()};
+        while (_entries.size() > _capacity)
+        {
+            _entries.erase(_lru.back());
+            _lru.pop_back();
+        }
+    }
+
+    void FileCache::setCapacity(std::size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _capacity = capacity;
+        while (_entries.size() > _capacity)
+        {
+            _entries.erase(_lru.back());
+            _lru.pop_back();
+        }
+    }
+
+    void FileCache::setMaxContentSize(std::size_t maxBytes)
+    {
+        _maxContentBytes = maxBytes;
+    }
+
+    std::size_t FileCache::size() const
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _entries.size();
+    }
+
+    std::uint64_t FileCache::hits() const
+    {
+        return _hits;
+    }
+
+    std::uint64_t FileCache::misses() const
+    {
+        return _misses;
+    }
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+#include <sys/stat.h>
+#include "Slice.h"
+
+namespace jrNetWork {
+    /* Open read-only file and its stat, closed when the cache and the last queued range let go of it */
+    struct OpenFile {
+        int fd = -1;
+        struct stat st;
+        /* Whole contents of a small file, loaded once and shared by every response sending it */
+        Slice content;
+
+        OpenFile(int fd, const struct stat& st);
+        ~OpenFile();
+
+        std::size_t size() const { return static_cast<std::size_t>(st.st_size); }
+
+        /* Not allowed Operation */
+        OpenFile(const OpenFile&) = delete;
+        OpenFile& operator=(const OpenFile&) = delete;
+    };
+
+    /* LRU cache of open regular files keyed by path, shared by the threads of a server.
+     * A hit costs no syscall; an entry older than the revalidation period is checked
+     * against stat(path) and reopened when the file was replaced or modified.
+     * Files up to the content limit are also kept in memory, once for all connections.
+     */
+    class FileCache {
+    public:
+        using FilePtr = std::shared_ptr<const OpenFile>;
+
+    private:
+        struct _Entry {
+            FilePtr file;
+            std::list<std::string>::iterator lru;
+            std::chrono::steady_clock::time_point checked;
+        };
+
+    private:
+        mutable std::mutex _mutex;
+        std::size_t _capacity;
+        std::chrono::milliseconds _revalidatePeriod;
+        std::atomic<std::size_t> _maxContentBytes{64 * 1024};
+        /* Most recently used path first */
+        std::list<std::string> _lru;
+        std::unordered_map<std::string, _Entry> _entries;
+        std::atomic<std::uint64_t> _hits{0};
+        std::atomic<std::uint64_t> _misses{0};
+
+        void _insert(const std::string& path, FilePtr file);
+        static Slice _load(const OpenFile& file);
+
+    public:
+        explicit FileCache(std::size_t capacity = 256,
+                           std::chrono::milliseconds revalidatePeriod = std::chrono::milliseconds(1000));
+        /* Open file of the path from the cache, null when it does not exist or is not a regular file */
+        FilePtr open(const std::string& path);
+        /* Bound the number of cached files (and fds), 0 disables caching */
+        void setCapacity(std::size_t capacity);
+        /* Keep the contents of files up to maxBytes (default 64 KB) in memory, 0 for none */
+        void setMaxContentSize(std::size_t maxBytes);
+        std::size_t size() const;
+        std::uint64_t hits() const;
+        std::uint64_t misses() const;
+
+    public:
+        /* Not allowed Operation */
+        FileCache(const FileCache&) = delete;
+        FileCache& operator=(const FileCache&) = delete;
+    };
+}
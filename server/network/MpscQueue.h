@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <utility>
+
+namespace jrNetWork
+{
+    /* Lock-free multi-producer single-consumer queue.
+     * Producers push onto an intrusive stack with a CAS; the consumer detaches the
+     * whole stack with one exchange and reverses it, so it takes a FIFO batch and
+     * never sees items pushed while it processes that batch.
+     */
+    template<class T>
+    class MpscQueue
+    {
+    private:
+        struct _Node
+        {
+            T value;
+            _Node* next;
+        };
+
+    private:
+        std::atomic<_Node*> _head{nullptr};
+
+    public:
+        MpscQueue() = default;
+
+        ~MpscQueue()
+        {
+            _Node* node = _head.exchange(nullptr, std::memory_order_acquire);
+            while (node)
+            {
+                _Node* next = node->next;
+                delete node;
+                node = next;
+            }
+        }
+
+        /* Any thread: returns true when the queue was empty, i.e. the consumer may need a wakeup */
+        bool push(T value)
+        {
+            _Node* node = new _Node{std::move(value), nullptr};
+            _Node* head = _head.load(std::memory_order_relaxed);
+            do
+            {
+                node->next = head;
+            } while (!_head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+            /* The node belongs to the consumer once published, only the local copy may be read */
+            return head == nullptr;
+        }
+
+        bool empty() const
+        {
+            return _head.load(std::memory_order_relaxed) == nullptr;
+        }
+
+        /* Consumer: take everything queued so far and call f on each item in push order,
+         * returns the number of items
+         */
+        template<typename F>
+        std::size_t consumeAll(F&& f)
+        {
+            _Node* node = _head.exchange(nullptr, std::memory_order_acquire);
+            _Node* fifo = nullptr;
+            while (node)
+            {
+                _Node* next = node->next;
+                node->next = fifo;
+                fifo = node;
+                node = next;
+            }
+            std::size_t n = 0;
+            while (fifo)
+            {
+                _Node* next = fifo->next;
+                f(fifo->value);
+                delete fifo;
+                fifo = next;
+                ++n;
+            }
+            return n;
+        }
+
+    public:
+        /* Not allowed Operation */
+        MpscQueue(const MpscQueue&) = delete;
+        MpscQueue& operator=(const MpscQueue&) = delete;
+    };
+}
@@ -2,7 +2,14 @@
 #include "Event.h"
 #include "Log.h"
 #include <unistd.h>
+#include <fcntl.h>
 #include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 namespace jrNetWork
 {
@@ -12,6 +19,7 @@ namespace jrNetWork
 	_MultiplexerBase::_MultiplexerBase()
 		: _waitEvN(0)
 		, _listenSock(0)
+		, _oneShot(false)
 		, _activateNativeEvents(eEventListInitSize)
 	{
 
@@ -101,31 +109,82 @@ namespace jrNetWork
 			}
 		}
 
-		void Multiplexer::_changeEvent(const Event& ev, int op)
+		/* Interest bits of an event type */
+		static std::uint32_t _interestMask(EventType type)
 		{
-			_NativeEvent ne;
-			ne.data.fd = ev.id;
-			switch (ev.type)
+			switch (type)
 			{
 			case EventType::LISTEN:
-				_listenSock = ev.id;
-			case EventType::READ:
 			case EventType::SIGNAL:
-				ne.events = EPOLLIN;
-				break;
+			case EventType::WAKEUP:
+			case EventType::READ:
+				return EPOLLIN;
 			case EventType::WRITE:
-				ne.events = EPOLLOUT;
-				break;
+				return EPOLLOUT;
 			default:
-				break;
+				return 0;
+			}
+		}
+
+		static std::uint64_t _nativeData(const Event& ev)
+		{
+			return static_cast<std::uint32_t>(ev.id) | (static_cast<std::uint64_t>(ev.generation) << 32);
+		}
+
+		Multiplexer::_Interest& Multiplexer::_interestOf(int fd)
+		{
+			if (static_cast<std::size_t>(fd) >= _interests.size())
+			{
+				_interests.resize(std::max<std::size_t>(fd + 1, _interests.size() * 2));
 			}
-			ne.events |= EPOLLET;
-			if (-1 == ::epoll_ctl(_epollfd, op, ne.data.fd, &ne))
+			return _interests[fd];
+		}
+
+		void Multiplexer::_markPending(int fd, _Interest& interest)
+		{
+			if (!interest.pending)
 			{
-				LOGWARN() << "Event regist/unregist failed: " << ::strerror(errno) << std::endl;
+				interest.pending = true;
+				_pendingFds.push_back(fd);
 			}
 		}
 
+		void Multiplexer::_flushChanges()
+		{
+			for (int fd : _pendingFds)
+			{
+				_Interest& interest = _interests[fd];
+				interest.pending = false;
+				if (!interest.rearm && (interest.registered == interest.wanted) && (interest.registeredData == interest.data))
+				{
+					continue;
+				}
+				int op = EPOLL_CTL_MOD;
+				if (interest.registered == 0)
+				{
+					op = EPOLL_CTL_ADD;
+				}
+				else if (interest.wanted == 0)
+				{
+					op = EPOLL_CTL_DEL;
+				}
+				_NativeEvent ne;
+				ne.data.u64 = interest.data;
+				ne.events = interest.wanted | interest.flags;
+				if (-1 == ::epoll_ctl(_epollfd, op, fd, &ne))
+				{
+					LOGWARN() << "Event regist/unregist failed: " << ::strerror(errno) << std::endl;
+					/* Kernel state is unknown now, make the next change start from scratch */
+					interest.registered = 0;
+					continue;
+				}
+				interest.registered = interest.wanted;
+				interest.registeredData = interest.data;
+				interest.rearm = false;
+			}
+			_pendingFds.clear();
+		}
+
 		Multiplexer::iterator Multiplexer::begin()
 		{
 			return Multiplexer::iterator(*this, 0);
@@ -138,26 +197,102 @@ namespace jrNetWork
 
 		void Multiplexer::registEvent(const Event& ev)
 		{
-			_changeEvent(ev, EPOLL_CTL_ADD);
+			_Interest& interest = _interestOf(ev.id);
+			if (ev.type == EventType::LISTEN)
+			{
+				_listenSock = ev.id;
+			}
+			interest.wanted |= _interestMask(ev.type);
+			interest.data = _nativeData(ev);
+			interest.flags = EPOLLET;
+			if ((ev.type == EventType::READ) || (ev.type == EventType::WRITE))
+			{
+				interest.flags |= (_oneShot ? EPOLLONESHOT : 0u);
+			}
+			_markPending(ev.id, interest);
 		}
 
 		void Multiplexer::unregistEvent(const Event& ev)
 		{
-			_changeEvent(ev, EPOLL_CTL_DEL);
+			_Interest& interest = _interestOf(ev.id);
+			interest.wanted &= ~_interestMask(ev.type);
+			_markPending(ev.id, interest);
 		}
 
-		void Multiplexer::wait(int timeoutMs)
+		void Multiplexer::rearmEvent(const Event& ev)
+		{
+			_Interest& interest = _interestOf(ev.id);
+			interest.wanted = _interestMask(ev.type);
+			interest.data = _nativeData(ev);
+			/* Always modified: the kernel checks readiness again, so input left unread is
+			 * reported without a new edge
+			 */
+			interest.rearm = true;
+			_markPending(ev.id, interest);
+		}
+
+		void Multiplexer::releaseFd(const Event& ev)
+		{
+			/* Closing the fd removes it from epoll, no syscall needed */
+			_Interest& interest = _interestOf(ev.id);
+			interest.wanted = interest.registered = 0;
+			interest.data = interest.registeredData = 0;
+			interest.rearm = false;
+		}
+
+		int Multiplexer::_epollWait(int timeoutMs)
 		{
 			int n = ::epoll_wait(_epollfd, &_activateNativeEvents[0],
 						   static_cast<int>(_activateNativeEvents.size()), timeoutMs);
-			if (-1 == n)
+			if ((-1 == n) && (errno != EINTR))
 			{
-				_waitEvN = 0;
-				// 
-				if (errno != EINTR)
+				LOGWARN() << "Epoll wait failed, " << ::strerror(errno) << std::endl;
+			}
+			return n;
+		}
+
+		void Multiplexer::wait(int timeoutMs)
+		{
+			_flushChanges();
+			int n = 0;
+			bool spun = false;
+			if ((_busyPollUs > 0) && (timeoutMs != 0))
+			{
+				/* Spin within the budget (never longer than the caller's timeout) to skip the wakeup latency */
+				auto budget = std::chrono::microseconds(_busyPollUs);
+				if ((timeoutMs > 0) && (budget > std::chrono::milliseconds(timeoutMs)))
 				{
-					LOGWARN() << "Epoll wait failed, " << ::strerror(errno) << std::endl;
+					budget = std::chrono::milliseconds(timeoutMs);
 				}
+				auto start = std::chrono::steady_clock::now();
+				auto deadline = start + budget;
+				do
+				{
+					n = _epollWait(0);
+				} while ((n == 0) && (std::chrono::steady_clock::now() < deadline));
+				spun = (n > 0);
+				/* The spin is part of the caller's timeout, block for what is left of it */
+				if (!spun && (timeoutMs > 0))
+				{
+					auto spent = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+					timeoutMs = (spent.count() < timeoutMs) ? timeoutMs - static_cast<int>(spent.count()) : 0;
+				}
+			}
+			if (spun)
+			{
+				++_spinWakeups;
+			}
+			else
+			{
+				if (timeoutMs != 0)
+				{
+					++_blockingWaits;
+				}
+				n = _epollWait(timeoutMs);
+			}
+			if (-1 == n)
+			{
+				_waitEvN = 0;
 			}
 			else if (n > 0)
 			{
@@ -171,9 +306,977 @@ namespace jrNetWork
 			else
 			{
 				_waitEvN = 0;
-				// ʱ
-				LOGNOTICE() << "Timeout." << std::endl;
 			}
 		}
 	}
+
+	namespace IoUring
+	{
+		constexpr unsigned eRingEntries = 1024;
+		/* user_data = fd | kind << 32 | generation << 40 */
+		constexpr std::uint32_t eKindRead = 1;
+		constexpr std::uint32_t eKindWrite = 2;
+		constexpr std::uint32_t eKindAccept = 3;
+		constexpr std::uint32_t eKindRecv = 4;
+		constexpr std::uint32_t eKindSend = 5;
+		constexpr std::uint32_t eKindProvide = 6;
+		constexpr std::uint32_t eKindMask = 0x3f;
+		constexpr std::uint32_t eKindOneShot = 0x40;
+		constexpr std::uint32_t eKindRemove = 0x80;
+		/* Provided buffers of multishot recv: a power of two of them, shared by the connections */
+		constexpr unsigned eRecvBuffers = 128;
+		constexpr std::size_t eRecvBufferSize = 16 * 1024;
+		constexpr std::uint16_t eRecvGroup = 0;
+		/* Buffers a connection may hold before its recv stops until it catches up,
+		 * so one slow reader cannot take the ring from the others
+		 */
+		constexpr std::size_t eRecvQueueMax = 8;
+
+		static int _ioUringSetup(unsigned entries, io_uring_params* p)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+		}
+
+		static int _ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void* arg, std::size_t argSize)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+		}
+
+		static int _ioUringRegister(int fd, unsigned opcode, void* arg, unsigned argNum)
+		{
+			return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, argNum));
+		}
+
+		static std::uint64_t _userData(int fd, std::uint32_t kind, std::uint32_t generation = 0)
+		{
+			return static_cast<std::uint32_t>(fd) | (static_cast<std::uint64_t>(kind & 0xff) << 32)
+				| (static_cast<std::uint64_t>(generation & eGenerationMask) << 40);
+		}
+
+		bool Multiplexer::isSupported()
+		{
+			io_uring_params p;
+			::memset(&p, 0, sizeof(p));
+			int fd = _ioUringSetup(2, &p);
+			if (-1 == fd)
+			{
+				return false;
+			}
+			::close(fd);
+			return (p.features & IORING_FEAT_EXT_ARG) && (p.features & IORING_FEAT_SINGLE_MMAP);
+		}
+
+		Multiplexer::Multiplexer()
+			: _MultiplexerBase()
+			, _ringfd(-1)
+			, _sqRing(MAP_FAILED)
+			, _cqRing(MAP_FAILED)
+			, _sqRingSize(0)
+			, _cqRingSize(0)
+			, _sqes(static_cast<io_uring_sqe*>(MAP_FAILED))
+			, _sqesSize(0)
+			, _sqEntries(0)
+			, _toSubmit(0)
+			, _bufRing(nullptr)
+			, _recvArena(nullptr)
+			, _bufTail(0)
+			, _multishotRecv(true)
+			, _recycled(false)
+		{
+			io_uring_params p;
+			::memset(&p, 0, sizeof(p));
+			_ringfd = _ioUringSetup(eRingEntries, &p);
+			if (-1 == _ringfd)
+			{
+				LOGFATAL() << "io_uring setup failed, " << ::strerror(errno) << std::endl;
+				return;
+			}
+			_sqEntries = p.sq_entries;
+			/* SQ and CQ rings share one mapping (IORING_FEAT_SINGLE_MMAP) */
+			_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+			_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+			_sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+			_sqRing = ::mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQ_RING);
+			_cqRing = _sqRing;
+			_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+			_sqes = static_cast<io_uring_sqe*>(::mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringfd, IORING_OFF_SQES));
+			if ((MAP_FAILED == _sqRing) || (MAP_FAILED == _sqes))
+			{
+				LOGFATAL() << "io_uring mmap failed, " << ::strerror(errno) << std::endl;
+				return;
+			}
+			char* sq = static_cast<char*>(_sqRing);
+			_sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+			_sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+			_sqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+			_sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+			char* cq = static_cast<char*>(_cqRing);
+			_cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+			_cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+			_cqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+			_cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+			_setupBufferRing();
+		}
+
+		Multiplexer::~Multiplexer()
+		{
+			if (MAP_FAILED != _sqes)
+			{
+				::munmap(_sqes, _sqesSize);
+			}
+			if (MAP_FAILED != _sqRing)
+			{
+				::munmap(_sqRing, _sqRingSize);
+			}
+			if ((-1 != _ringfd) && (-1 == ::close(_ringfd)))
+			{
+				LOGWARN() << "io_uring closed failed: " << ::strerror(errno) << std::endl;
+			}
+			/* Closing the ring dropped the kernel's use of the provided buffers */
+			if (_bufRing)
+			{
+				::munmap(_bufRing, eRecvBuffers * sizeof(io_uring_buf));
+			}
+			if (_recvArena)
+			{
+				::munmap(_recvArena, eRecvBuffers * eRecvBufferSize);
+			}
+		}
+
+		void Multiplexer::_setupBufferRing()
+		{
+			void* arena = ::mmap(nullptr, eRecvBuffers * eRecvBufferSize, PROT_READ | PROT_WRITE,
+								 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (MAP_FAILED == arena)
+			{
+				/* Connections fall back to poll readiness and socket syscalls */
+				LOGNOTICE() << "io_uring provided buffers unavailable, " << ::strerror(errno) << std::endl;
+				return;
+			}
+			_recvArena = static_cast<char*>(arena);
+			void* ring = ::mmap(nullptr, eRecvBuffers * sizeof(io_uring_buf), PROT_READ | PROT_WRITE,
+								MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			io_uring_buf_reg reg;
+			::memset(&reg, 0, sizeof(reg));
+			reg.ring_addr = reinterpret_cast<std::uint64_t>(ring);
+			reg.ring_entries = eRecvBuffers;
+			reg.bgid = eRecvGroup;
+			if ((MAP_FAILED != ring) && (0 == _ioUringRegister(_ringfd, IORING_REGISTER_PBUF_RING, &reg, 1)))
+			{
+				_bufRing = static_cast<io_uring_buf_ring*>(ring);
+				for (unsigned bid = 0; bid < eRecvBuffers; ++bid)
+				{
+					_recycle(static_cast<std::uint16_t>(bid));
+				}
+				if (_probeBufferRing())
+				{
+					return;
+				}
+				/* Registered but never handing a buffer out (seen on some kernels): use the classic way */
+				LOGNOTICE() << "io_uring buffer ring refused by recv, providing buffers by SQE" << std::endl;
+				_ioUringRegister(_ringfd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+				_bufRing = nullptr;
+				_bufTail = 0;
+			}
+			if (MAP_FAILED != ring)
+			{
+				::munmap(ring, eRecvBuffers * sizeof(io_uring_buf));
+			}
+			/* Before 5.19: hand all buffers to the group with one SQE, sent with the first wait */
+			io_uring_sqe* sqe = _getSqe();
+			if (nullptr == sqe)
+			{
+				::munmap(_recvArena, eRecvBuffers * eRecvBufferSize);
+				_recvArena = nullptr;
+				return;
+			}
+			sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+			sqe->fd = eRecvBuffers;
+			sqe->addr = reinterpret_cast<std::uint64_t>(_recvArena);
+			sqe->len = eRecvBufferSize;
+			sqe->off = 0;
+			sqe->buf_group = eRecvGroup;
+			sqe->user_data = _userData(0, eKindProvide);
+		}
+
+		bool Multiplexer::_probeBufferRing()
+		{
+			/* Read one byte of a pipe into a buffer of the ring, before any other request exists */
+			int pipefd[2];
+			if (-1 == ::pipe2(pipefd, O_CLOEXEC))
+			{
+				return false;
+			}
+			bool taken = false;
+			io_uring_sqe* sqe = (1 == ::write(pipefd[1], "", 1)) ? _getSqe() : nullptr;
+			if (sqe)
+			{
+				sqe->opcode = IORING_OP_READ;
+				sqe->fd = pipefd[0];
+				sqe->off = static_cast<std::uint64_t>(-1);
+				sqe->len = eRecvBufferSize;
+				sqe->flags = IOSQE_BUFFER_SELECT;
+				sqe->buf_group = eRecvGroup;
+				int n = _ioUringEnter(_ringfd, _toSubmit, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+				_toSubmit = 0;
+				unsigned head = *_cqHead;
+				if ((n >= 0) && (head != __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE)))
+				{
+					const io_uring_cqe& cqe = _cqes[head & *_cqMask];
+					taken = (cqe.res == 1) && (cqe.flags & IORING_CQE_F_BUFFER);
+					if (taken)
+					{
+						_recycle(static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+					}
+					__atomic_store_n(_cqHead, head + 1, __ATOMIC_RELEASE);
+				}
+			}
+			::close(pipefd[0]);
+			::close(pipefd[1]);
+			return taken;
+		}
+
+		void Multiplexer::_recycle(std::uint16_t bid)
+		{
+			_recycled = true;
+			if (_bufRing)
+			{
+				io_uring_buf& buf = _bufRing->bufs[_bufTail & (eRecvBuffers - 1)];
+				buf.addr = reinterpret_cast<std::uint64_t>(_recvArena + bid * eRecvBufferSize);
+				buf.len = eRecvBufferSize;
+				buf.bid = bid;
+				__atomic_store_n(&_bufRing->tail, ++_bufTail, __ATOMIC_RELEASE);
+				return;
+			}
+			/* Batched with the next wait, ahead of any recv it re-arms */
+			io_uring_sqe* sqe = _getSqe();
+			if (nullptr == sqe)
+			{
+				LOGWARN() << "io_uring SQ full, provided buffer " << bid << " lost" << std::endl;
+				return;
+			}
+			sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+			sqe->fd = 1;
+			sqe->addr = reinterpret_cast<std::uint64_t>(_recvArena + bid * eRecvBufferSize);
+			sqe->len = eRecvBufferSize;
+			sqe->off = bid;
+			sqe->buf_group = eRecvGroup;
+			sqe->user_data = _userData(0, eKindProvide);
+		}
+
+		io_uring_sqe* Multiplexer::_getSqe()
+		{
+			if (-1 == _ringfd)
+			{
+				return nullptr;
+			}
+			unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+			unsigned tail = *_sqTail;
+			/* Ring is full, push the queued SQEs to kernel first */
+			if (tail - head >= _sqEntries)
+			{
+				_submit();
+				head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+				if (tail - head >= _sqEntries)
+				{
+					return nullptr;
+				}
+			}
+			unsigned idx = tail & *_sqMask;
+			io_uring_sqe* sqe = &_sqes[idx];
+			::memset(sqe, 0, sizeof(io_uring_sqe));
+			_sqArray[idx] = idx;
+			__atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+			++_toSubmit;
+			return sqe;
+		}
+
+		void Multiplexer::_submit()
+		{
+			while (_toSubmit > 0)
+			{
+				int n = _ioUringEnter(_ringfd, _toSubmit, 0, 0, nullptr, 0);
+				if (-1 == n)
+				{
+					if (errno == EINTR)
+					{
+						continue;
+					}
+					LOGWARN() << "io_uring submit failed, " << ::strerror(errno) << std::endl;
+					break;
+				}
+				_toSubmit -= n;
+			}
+		}
+
+		void Multiplexer::_armPoll(int fd, std::uint32_t generation, std::uint32_t kind, bool oneShot)
+		{
+			io_uring_sqe* sqe = _getSqe();
+			if (!sqe)
+			{
+				LOGWARN() << "io_uring submission queue full, fd " << fd << std::endl;
+				return;
+			}
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = fd;
+			sqe->poll32_events = (kind == eKindWrite) ? EPOLLOUT : EPOLLIN;
+			sqe->len = oneShot ? 0 : IORING_POLL_ADD_MULTI;
+			sqe->user_data = _userData(fd, kind | (oneShot ? eKindOneShot : 0), generation);
+		}
+
+		void Multiplexer::_armAccept(int fd)
+		{
+			io_uring_sqe* sqe = _getSqe();
+			if (!sqe)
+			{
+				LOGWARN() << "io_uring submission queue full, fd " << fd << std::endl;
+				return;
+			}
+			sqe->opcode = IORING_OP_ACCEPT;
+			sqe->fd = fd;
+			sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+			sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+			sqe->user_data = _userData(fd, eKindAccept);
+		}
+
+		void Multiplexer::_armRecv(int fd, std::uint32_t generation)
+		{
+			io_uring_sqe* sqe = _getSqe();
+			if (!sqe)
+			{
+				LOGWARN() << "io_uring submission queue full, fd " << fd << std::endl;
+				return;
+			}
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = fd;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = eRecvGroup;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->user_data = _userData(fd, eKindRecv, generation);
+		}
+
+		void Multiplexer::_cancel(int fd, std::uint32_t generation, std::uint32_t kind, bool oneShot)
+		{
+			io_uring_sqe* sqe = _getSqe();
+			if (!sqe)
+			{
+				LOGWARN() << "io_uring submission queue full, fd " << fd << std::endl;
+				return;
+			}
+			bool poll = (kind == eKindRead) || (kind == eKindWrite);
+			sqe->opcode = poll ? IORING_OP_POLL_REMOVE : IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = _userData(fd, kind | ((poll && oneShot) ? eKindOneShot : 0), generation);
+			sqe->user_data = _userData(fd, kind | eKindRemove);
+		}
+
+		Multiplexer::_Requests& Multiplexer::_requestsOf(int fd)
+		{
+			if (static_cast<std::size_t>(fd) >= _requests.size())
+			{
+				_requests.resize(std::max<std::size_t>(fd + 1, _requests.size() * 2));
+			}
+			return _requests[fd];
+		}
+
+		Multiplexer::_Requests* Multiplexer::_receiverOf(const Event& ev)
+		{
+			if (static_cast<std::size_t>(ev.id) >= _requests.size())
+			{
+				return nullptr;
+			}
+			_Requests& requests = _requests[ev.id];
+			return (requests.receiving && (requests.generation == (ev.generation & eGenerationMask))) ? &requests : nullptr;
+		}
+
+		void Multiplexer::_reset(_Requests& requests)
+		{
+			for (const _Piece& piece : requests.received)
+			{
+				_recycle(piece.bid);
+			}
+			requests = _Requests();
+		}
+
+		void Multiplexer::_arm(int fd, _Requests& requests, std::uint32_t kind)
+		{
+			if ((kind == eKindRecv) && (requests.recvEnded || (requests.received.size() >= eRecvQueueMax)))
+			{
+				/* Nothing more to read, or armed again once the queue is taken */
+				return;
+			}
+			requests.armed |= (1u << kind);
+			if (kind == eKindAccept)
+			{
+				_armAccept(fd);
+			}
+			else if (kind == eKindRecv)
+			{
+				_armRecv(fd, requests.generation);
+			}
+			else
+			{
+				_armPoll(fd, requests.generation, kind, requests.oneShot);
+			}
+		}
+
+		void Multiplexer::_want(int fd, _Requests& requests, std::uint32_t kind)
+		{
+			requests.wanted |= (1u << kind);
+			/* A request still alive keeps reporting, one being cancelled is replaced when it ends */
+			if (!(requests.armed & (1u << kind)))
+			{
+				_arm(fd, requests, kind);
+			}
+		}
+
+		void Multiplexer::_stop(int fd, _Requests& requests, std::uint32_t kind)
+		{
+			std::uint32_t bit = 1u << kind;
+			if ((requests.armed & bit) && !(requests.cancelling & bit))
+			{
+				_cancel(fd, requests.generation, kind, requests.oneShot);
+				requests.cancelling |= bit;
+			}
+		}
+
+		void Multiplexer::_unwant(int fd, _Requests& requests, std::uint32_t kind)
+		{
+			requests.wanted &= ~(1u << kind);
+			_stop(fd, requests, kind);
+		}
+
+		void Multiplexer::_finish(int fd, _Requests& requests, std::uint32_t kind)
+		{
+			std::uint32_t bit = 1u << kind;
+			requests.armed &= ~bit;
+			requests.cancelling &= ~bit;
+			if (requests.wanted & bit)
+			{
+				_arm(fd, requests, kind);
+			}
+		}
+
+		void Multiplexer::_changeEvent(const Event& ev, int op)
+		{
+			std::uint32_t kind = eKindRead;
+			bool oneShot = _oneShot;
+			switch (ev.type)
+			{
+			case EventType::LISTEN:
+				_listenSock = ev.id;
+				kind = eKindAccept;
+				oneShot = false;
+				break;
+			case EventType::WRITE:
+				kind = eKindWrite;
+				break;
+			case EventType::READ:
+				break;
+			default:
+				oneShot = false;
+				break;
+			}
+			_Requests& requests = _requestsOf(ev.id);
+			std::uint32_t generation = ev.generation & eGenerationMask;
+			if (requests.generation != generation)
+			{
+				if (op != EPOLL_CTL_ADD)
+				{
+					/* The fd was released and belongs to another connection now */
+					return;
+				}
+				_reset(requests);
+				requests.generation = generation;
+			}
+			requests.oneShot = oneShot;
+			if ((kind == eKindRead) && requests.receiving)
+			{
+				kind = eKindRecv;
+			}
+			if (op == EPOLL_CTL_DEL)
+			{
+				_unwant(ev.id, requests, kind);
+				return;
+			}
+			if ((op == EPOLL_CTL_MOD) && (kind != eKindAccept))
+			{
+				/* The interest becomes ev.type alone, like an epoll modification; a receiving
+				 * connection keeps reading while it waits to write
+				 */
+				if (kind == eKindWrite)
+				{
+					_unwant(ev.id, requests, eKindRead);
+				}
+				else
+				{
+					_unwant(ev.id, requests, eKindWrite);
+				}
+			}
+			_want(ev.id, requests, kind);
+		}
+
+		Multiplexer::iterator Multiplexer::begin()
+		{
+			return Multiplexer::iterator(*this, 0);
+		}
+
+		Multiplexer::iterator Multiplexer::end()
+		{
+			return Multiplexer::iterator(*this, _waitEvN);
+		}
+
+		void Multiplexer::registEvent(const Event& ev)
+		{
+			_changeEvent(ev, EPOLL_CTL_ADD);
+		}
+
+		void Multiplexer::unregistEvent(const Event& ev)
+		{
+			_changeEvent(ev, EPOLL_CTL_DEL);
+		}
+
+		void Multiplexer::rearmEvent(const Event& ev)
+		{
+			_Requests& requests = _requestsOf(ev.id);
+			std::uint32_t kind = (ev.type == EventType::WRITE) ? eKindWrite : eKindRead;
+			bool wasArmed = (requests.generation == (ev.generation & eGenerationMask)) && (requests.armed & (1u << kind));
+			_changeEvent(ev, EPOLL_CTL_MOD);
+			/* A new poll checks readiness when armed, a multishot one still armed only reports the
+			 * next wakeup: restart it so input left unread is reported, like an epoll modification
+			 */
+			if (wasArmed && !requests.oneShot && (requests.wanted & (1u << kind)))
+			{
+				_stop(ev.id, requests, kind);
+			}
+		}
+
+		void Multiplexer::releaseFd(const Event& ev)
+		{
+			_Requests& requests = _requestsOf(ev.id);
+			if (requests.generation != (ev.generation & eGenerationMask))
+			{
+				return;
+			}
+			/* Requests hold the file open, the connection only closes once they are gone */
+			for (std::uint32_t kind : {eKindRead, eKindWrite, eKindRecv})
+			{
+				_unwant(ev.id, requests, kind);
+			}
+			auto it = _sends.find(_userData(ev.id, eKindSend, requests.generation));
+			if (it != _sends.end())
+			{
+				if (it->second.done)
+				{
+					_sends.erase(it);
+				}
+				else
+				{
+					it->second.released = true;
+					_cancel(ev.id, requests.generation, eKindSend, false);
+				}
+			}
+			for (const _Piece& piece : requests.received)
+			{
+				_recycle(piece.bid);
+			}
+			requests.received.clear();
+			requests.receiving = false;
+		}
+
+		bool Multiplexer::takeAccepted(int& fd)
+		{
+			if (_acceptedFds.empty())
+			{
+				return false;
+			}
+			fd = _acceptedFds.front();
+			_acceptedFds.pop_front();
+			return true;
+		}
+
+		bool Multiplexer::startReceive(const Event& ev)
+		{
+			if (!_recvArena || !_multishotRecv)
+			{
+				return false;
+			}
+			_Requests& requests = _requestsOf(ev.id);
+			std::uint32_t generation = ev.generation & eGenerationMask;
+			if (requests.generation != generation)
+			{
+				_reset(requests);
+				requests.generation = generation;
+			}
+			requests.receiving = true;
+			_want(ev.id, requests, eKindRecv);
+			return true;
+		}
+
+		long Multiplexer::_drainReceived(int fd, _Requests& requests, char* buf, std::size_t length, Buffer* buffer)
+		{
+			std::size_t taken = 0;
+			std::size_t used = 0;
+			for (; (used < requests.received.size()) && (taken < length); ++used)
+			{
+				_Piece& piece = requests.received[used];
+				const char* data = _recvArena + piece.bid * eRecvBufferSize + piece.offset;
+				std::size_t n = std::min<std::size_t>(piece.length, length - taken);
+				if (buffer)
+				{
+					buffer->append(data, n);
+				}
+				else
+				{
+					::memcpy(buf + taken, data, n);
+				}
+				taken += n;
+				piece.offset += n;
+				piece.length -= n;
+				if (piece.length > 0)
+				{
+					break;
+				}
+				_recycle(piece.bid);
+			}
+			requests.received.erase(requests.received.begin(), requests.received.begin() + used);
+			/* A recv stopped at the queue cap goes on */
+			if ((requests.wanted & (1u << eKindRecv)) && !(requests.armed & (1u << eKindRecv)))
+			{
+				_arm(fd, requests, eKindRecv);
+			}
+			if (taken > 0)
+			{
+				return static_cast<long>(taken);
+			}
+			if (requests.recvEnded)
+			{
+				if (requests.recvError == 0)
+				{
+					return 0;
+				}
+				errno = -requests.recvError;
+				return -1;
+			}
+			errno = EAGAIN;
+			return -1;
+		}
+
+		bool Multiplexer::takeReceived(const Event& ev, Buffer& buffer, long& n)
+		{
+			_Requests* requests = _receiverOf(ev);
+			if (!requests)
+			{
+				return false;
+			}
+			n = _drainReceived(ev.id, *requests, nullptr, SIZE_MAX, &buffer);
+			return true;
+		}
+
+		bool Multiplexer::takeReceived(const Event& ev, char* buf, std::size_t length, long& n)
+		{
+			_Requests* requests = _receiverOf(ev);
+			if (!requests)
+			{
+				return false;
+			}
+			n = _drainReceived(ev.id, *requests, buf, length, nullptr);
+			return true;
+		}
+
+		bool Multiplexer::hasReceived(const Event& ev) const
+		{
+			if (static_cast<std::size_t>(ev.id) >= _requests.size())
+			{
+				return false;
+			}
+			const _Requests& requests = _requests[ev.id];
+			return requests.receiving && (requests.generation == (ev.generation & eGenerationMask))
+				&& (!requests.received.empty() || requests.recvEnded);
+		}
+
+		bool Multiplexer::submitSend(const Event& ev, const ChunkQueue& queue)
+		{
+			std::uint64_t key = _userData(ev.id, eKindSend, ev.generation);
+			if (_sends.count(key) != 0)
+			{
+				return false;
+			}
+			_Send& send = _sends[key];
+			int iovCnt = queue.pinIov(send.iov, ChunkQueue::eMaxIov, send.pinned);
+			io_uring_sqe* sqe = (iovCnt > 0) ? _getSqe() : nullptr;
+			if (!sqe)
+			{
+				_sends.erase(key);
+				return false;
+			}
+			::memset(&send.msg, 0, sizeof(send.msg));
+			send.msg.msg_iov = send.iov;
+			send.msg.msg_iovlen = iovCnt;
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = ev.id;
+			sqe->addr = reinterpret_cast<std::uint64_t>(&send.msg);
+			sqe->len = 1;
+			sqe->msg_flags = MSG_NOSIGNAL;
+			sqe->user_data = key;
+			return true;
+		}
+
+		bool Multiplexer::takeSent(const Event& ev, long& result)
+		{
+			auto it = _sends.find(_userData(ev.id, eKindSend, ev.generation));
+			if ((it == _sends.end()) || !it->second.done)
+			{
+				return false;
+			}
+			result = it->second.result;
+			_sends.erase(it);
+			return true;
+		}
+
+		void Multiplexer::_report(int fd, std::uint32_t generation, std::uint32_t events)
+		{
+			_NativeEvent ne;
+			ne.events = events;
+			ne.data.u64 = static_cast<std::uint32_t>(fd) | (static_cast<std::uint64_t>(generation) << 32);
+			if (static_cast<std::size_t>(_waitEvN + 1) >= _activateNativeEvents.size())
+			{
+				_activateNativeEvents.resize(_activateNativeEvents.size() * 2);
+			}
+			_activateNativeEvents[_waitEvN++] = ne;
+		}
+
+		void Multiplexer::_completeRecv(int fd, std::uint32_t generation, const io_uring_cqe& cqe)
+		{
+			bool more = cqe.flags & IORING_CQE_F_MORE;
+			_Requests& requests = _requestsOf(fd);
+			bool live = requests.receiving && (requests.generation == generation);
+			if (cqe.flags & IORING_CQE_F_BUFFER)
+			{
+				std::uint16_t bid = static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+				if (!live || (cqe.res <= 0))
+				{
+					_recycle(bid);
+				}
+				else
+				{
+					requests.received.push_back(_Piece{bid, 0, static_cast<std::uint32_t>(cqe.res)});
+				}
+			}
+			if (requests.generation != generation)
+			{
+				return;
+			}
+			if (live && (cqe.res == -EINVAL) && requests.received.empty())
+			{
+				/* No multishot recv in this kernel: poll readiness and socket reads from now on */
+				LOGNOTICE() << "io_uring multishot recv unsupported, falling back to poll" << std::endl;
+				_multishotRecv = false;
+				requests.wanted &= ~(1u << eKindRecv);
+				requests.receiving = false;
+				_finish(fd, requests, eKindRecv);
+				_want(fd, requests, eKindRead);
+				_report(fd, generation, EPOLLIN);
+				return;
+			}
+			if (live && (cqe.res != -ECANCELED) && (cqe.res != -ENOBUFS))
+			{
+				if (cqe.res <= 0)
+				{
+					requests.recvEnded = true;
+					requests.recvError = cqe.res;
+				}
+				_report(fd, generation, EPOLLIN);
+				if (more && (requests.received.size() >= eRecvQueueMax))
+				{
+					/* The reader falls behind, leave the rest in the socket until it catches up */
+					_stop(fd, requests, eKindRecv);
+				}
+			}
+			if (!more)
+			{
+				if (live && (cqe.res == -ENOBUFS))
+				{
+					/* The ring ran dry: armed again once buffers come back */
+					requests.armed &= ~(1u << eKindRecv);
+					requests.cancelling &= ~(1u << eKindRecv);
+					_starved.push_back(fd);
+					return;
+				}
+				_finish(fd, requests, eKindRecv);
+			}
+		}
+
+		void Multiplexer::_completeSend(int fd, std::uint32_t generation, const io_uring_cqe& cqe)
+		{
+			auto it = _sends.find(cqe.user_data);
+			if (it == _sends.end())
+			{
+				return;
+			}
+			if (it->second.released || (_requestsOf(fd).generation != generation))
+			{
+				_sends.erase(it);
+				return;
+			}
+			it->second.pinned.clear();
+			it->second.result = cqe.res;
+			it->second.done = true;
+			_report(fd, generation, EPOLLOUT);
+		}
+
+		void Multiplexer::wait(int timeoutMs)
+		{
+			_waitEvN = 0;
+			if (-1 == _ringfd)
+			{
+				return;
+			}
+			/* Connections starved of buffers read again once some came back, not before, or a
+			 * starved recv would fail again at once and spin the loop
+			 */
+			if (!_starved.empty() && _recycled)
+			{
+				_recycled = false;
+				for (int fd : _starved)
+				{
+					_Requests& requests = _requests[fd];
+					if (requests.receiving && (requests.wanted & (1u << eKindRecv)) && !(requests.armed & (1u << eKindRecv)))
+					{
+						_arm(fd, requests, eKindRecv);
+					}
+				}
+				_starved.clear();
+			}
+			/* Submit queued changes and sends and wait in one syscall (busy poll is an epoll-only mode) */
+			if (timeoutMs != 0)
+			{
+				++_blockingWaits;
+			}
+			__kernel_timespec ts;
+			io_uring_getevents_arg arg;
+			::memset(&arg, 0, sizeof(arg));
+			if (timeoutMs >= 0)
+			{
+				ts.tv_sec = timeoutMs / 1000;
+				ts.tv_nsec = static_cast<long long>(timeoutMs % 1000) * 1000000;
+				arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+			}
+			bool ready = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE) != *_cqHead;
+			int n = _ioUringEnter(_ringfd, _toSubmit, ready ? 0 : 1,
+								  IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+			if (-1 == n)
+			{
+				if ((errno != EINTR) && (errno != ETIME))
+				{
+					LOGWARN() << "io_uring wait failed, " << ::strerror(errno) << std::endl;
+				}
+			}
+			else
+			{
+				_toSubmit -= std::min(_toSubmit, static_cast<unsigned>(n));
+			}
+			/* Translate completions to native events */
+			bool listenReady = false;
+			unsigned head = *_cqHead;
+			unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+			for (; head != tail; ++head)
+			{
+				const io_uring_cqe& cqe = _cqes[head & *_cqMask];
+				int fd = static_cast<int>(cqe.user_data & 0xffffffffu);
+				std::uint32_t kind = static_cast<std::uint32_t>(cqe.user_data >> 32) & 0xff;
+				std::uint32_t generation = static_cast<std::uint32_t>(cqe.user_data >> 40);
+				bool more = cqe.flags & IORING_CQE_F_MORE;
+				bool oneShot = kind & eKindOneShot;
+				if (kind & eKindRemove)
+				{
+					continue;
+				}
+				kind &= eKindMask;
+				if (kind == eKindProvide)
+				{
+					if (cqe.res < 0)
+					{
+						LOGWARN() << "io_uring provide buffers failed, " << ::strerror(-cqe.res) << std::endl;
+					}
+					continue;
+				}
+				if (kind == eKindRecv)
+				{
+					_completeRecv(fd, generation, cqe);
+					continue;
+				}
+				if (kind == eKindSend)
+				{
+					_completeSend(fd, generation, cqe);
+					continue;
+				}
+				_Requests& requests = _requestsOf(fd);
+				/* Completions of a released fd change nothing, its new owner has its own requests */
+				if (requests.generation != generation)
+				{
+					continue;
+				}
+				if (cqe.res == -ECANCELED)
+				{
+					_finish(fd, requests, kind);
+					continue;
+				}
+				if (kind == eKindAccept)
+				{
+					if (cqe.res >= 0)
+					{
+						_acceptedFds.push_back(cqe.res);
+						listenReady = true;
+					}
+					else if ((cqe.res == -EMFILE) || (cqe.res == -ENFILE))
+					{
+						/* Out of fds, let the loop shed connections through its own accept path */
+						listenReady = true;
+					}
+					else
+					{
+						LOGWARN() << "Multishot accept failed, " << ::strerror(-cqe.res) << std::endl;
+					}
+					if (!more)
+					{
+						_finish(fd, requests, kind);
+					}
+					continue;
+				}
+				if (cqe.res >= 0)
+				{
+					_report(fd, generation, static_cast<std::uint32_t>(cqe.res));
+				}
+				if (!more)
+				{
+					/* A fired one-shot waits for the loop's rearm, a failed or hung up poll is not renewed */
+					if (oneShot || (cqe.res < 0) || (cqe.res & EPOLLHUP))
+					{
+						requests.wanted &= ~(1u << kind);
+					}
+					_finish(fd, requests, kind);
+				}
+			}
+			__atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+			/* All accepted connections are reported by one listen event */
+			if (listenReady)
+			{
+				_report(_listenSock, 0, EPOLLIN);
+			}
+		}
+	}
+
+	std::unique_ptr<_MultiplexerBase> createMultiplexer(MultiplexerType type)
+	{
+		if (type == MultiplexerType::IO_URING)
+		{
+			if (IoUring::Multiplexer::isSupported())
+			{
+				return std::make_unique<IoUring::Multiplexer>();
+			}
+			LOGWARN() << "io_uring is not supported, fall back to epoll" << std::endl;
+		}
+		return std::make_unique<Epoll::Multiplexer>();
+	}
 }
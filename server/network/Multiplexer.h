@@ -1,23 +1,47 @@
 #pragma once
 
 #include "Event.h"
+#include "Buffer.h"
+#include "ChunkQueue.h"
+#include <deque>
+#include <atomic>
+#include <memory>
 #include <vector>
+#include <cstdint>
 #include <iterator>
+#include <unordered_map>
 #include <sys/poll.h>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
 
 namespace jrNetWork
 {
 	class MultiplexerIterator;
 
+	/* IO multiplexing backend, chosen when the event loop is constructed */
+	enum class MultiplexerType
+	{
+		EPOLL,
+		IO_URING
+	};
+
     class _MultiplexerBase
     {
 		friend class MultiplexerIterator;
 	protected:
 		int _waitEvN;
 		int _listenSock;
+		/* Arm connection READ/WRITE events one-shot, rearmEvent gives them back */
+		bool _oneShot;
+		/* Busy poll budget in microseconds, 0 for always blocking */
+		std::uint32_t _busyPollUs = 0;
+		std::atomic<std::uint64_t> _spinWakeups{0};
+		std::atomic<std::uint64_t> _blockingWaits{0};
 		std::vector<_NativeEvent> _activateNativeEvents;
-		virtual void _changeEvent(const Event& event, int op) = 0;
 
 	public:
 		using iterator = MultiplexerIterator;
@@ -28,7 +52,39 @@ namespace jrNetWork
 		virtual iterator end() = 0;
         virtual void registEvent(const Event&) = 0;
         virtual void unregistEvent(const Event&) = 0;
+		/* Set the interest of a registered connection to ev.type and arm it again, readiness which
+		 * is already there (input left unread) is reported again.
+		 * Like every other call it must come from the loop thread, see EventLoop::runInLoop.
+		 */
+		virtual void rearmEvent(const Event&) = 0;
+		/* Forget every interest of a fd which is about to be closed */
+		virtual void releaseFd(const Event&) = 0;
         virtual void wait(int t = -1) = 0;
+		void setOneShot(bool oneShot) { _oneShot = oneShot; }
+		/* Spin on a non-blocking wait for budgetUs before blocking, 0 disables it */
+		void setBusyPoll(std::uint32_t budgetUs) { _busyPollUs = budgetUs; }
+		/* Waits which found events while spinning, and waits which had to block */
+		std::uint64_t spinWakeups() const { return _spinWakeups; }
+		std::uint64_t blockingWaits() const { return _blockingWaits; }
+		/* Take a connection accepted by the backend itself, false when the caller must accept */
+		virtual bool takeAccepted(int&) { return false; }
+		/* Completion I/O, for connections served on the loop thread. A connection started with
+		 * startReceive has its input read by the backend, which reports READ once some is queued;
+		 * takeReceived moves it out with the results of Socket::recvSome. Both are false when the
+		 * backend leaves reading to the caller, who registers the connection for READ instead.
+		 */
+		virtual bool startReceive(const Event&) { return false; }
+		virtual bool takeReceived(const Event&, Buffer&, long&) { return false; }
+		virtual bool takeReceived(const Event&, char*, std::size_t, long&) { return false; }
+		/* Input or the end of stream is queued and not taken yet */
+		virtual bool hasReceived(const Event&) const { return false; }
+		/* Write the in-memory chunks at the front of queue, reported by a WRITE event once done.
+		 * The chunks are shared until then, the queue itself is left as it is. False when the
+		 * backend does not write, or the front is a file range.
+		 */
+		virtual bool submitSend(const Event&, const ChunkQueue&) { return false; }
+		/* Result of a completed send: bytes written or -errno, false while it is in flight */
+		virtual bool takeSent(const Event&, long&) { return false; }
     };
 
 	class MultiplexerIterator : public std::iterator<std::bidirectional_iterator_tag, Event>
@@ -58,11 +114,34 @@ namespace jrNetWork
 
     namespace Epoll
     {
+		/* Changes of the interest set are cached per fd and applied once per loop iteration
+		 * right before epoll_wait; redundant changes cost no syscall, except one-shot rearms
+		 * which the kernel needs even when the interest is unchanged.
+		 */
 		class Multiplexer : public _MultiplexerBase
 		{
 		private:
+			struct _Interest
+			{
+				std::uint32_t registered = 0;	// Interest known by the kernel, 0 for not added
+				std::uint32_t wanted = 0;		// Interest after the pending changes
+				std::uint32_t flags = 0;
+				std::uint64_t registeredData = 0;
+				std::uint64_t data = 0;
+				bool pending = false;
+				bool rearm = false;		// A fired one-shot interest must be modified again
+			};
+
 			int _epollfd;
-			void _changeEvent(const Event& ev, int op) override;
+			/* Indexed by fd, only touched by the loop thread */
+			std::vector<_Interest> _interests;
+			std::vector<int> _pendingFds;
+
+			_Interest& _interestOf(int fd);
+			void _markPending(int fd, _Interest& interest);
+			void _flushChanges();
+			/* epoll_wait into _activateNativeEvents, returns the event number or -1 */
+			int _epollWait(int timeoutMs);
 
 		public:
 			Multiplexer();
@@ -73,7 +152,150 @@ namespace jrNetWork
 
 			void registEvent(const Event& ev) override;
 			void unregistEvent(const Event& ev) override;
+			void rearmEvent(const Event& ev) override;
+			void releaseFd(const Event& ev) override;
 			void wait(int timeoutMs = -1) override;
 		};
     }
+
+	namespace IoUring
+	{
+		/* Completion based backend on io_uring (raw syscalls, kernel 5.19+).
+		 * The listener uses multishot accept. Connections started with startReceive are read by
+		 * multishot recv into a ring of provided buffers and written by SENDMSG requests; the others
+		 * get readiness from poll requests. Every request and change is queued as an SQE and
+		 * submitted together with the wait, so one loop iteration costs one io_uring_enter.
+		 */
+		class Multiplexer : public _MultiplexerBase
+		{
+		private:
+			/* Received bytes still in a provided buffer */
+			struct _Piece
+			{
+				std::uint16_t bid;
+				std::uint32_t offset;
+				std::uint32_t length;
+			};
+
+			/* Requests of one fd, by kind: wanted by the loop, alive in the kernel, asked to stop.
+			 * A kind is armed again only after its last request ended, so two never run at once.
+			 */
+			struct _Requests
+			{
+				std::uint32_t generation = 0;
+				std::uint32_t wanted = 0;		// Bit (1 << kind) per kind
+				std::uint32_t armed = 0;
+				std::uint32_t cancelling = 0;
+				bool oneShot = false;
+				/* Input comes by multishot recv and waits here until it is taken */
+				bool receiving = false;
+				bool recvEnded = false;
+				int recvError = 0;
+				std::vector<_Piece> received;
+			};
+
+			/* A write in flight, owning what the kernel reads until its completion */
+			struct _Send
+			{
+				msghdr msg;
+				iovec iov[ChunkQueue::eMaxIov];
+				std::vector<Slice> pinned;
+				long result = 0;
+				bool done = false;
+				bool released = false;
+			};
+
+			int _ringfd;
+			/* Mapped rings */
+			void* _sqRing;
+			void* _cqRing;
+			std::size_t _sqRingSize;
+			std::size_t _cqRingSize;
+			struct io_uring_sqe* _sqes;
+			std::size_t _sqesSize;
+			unsigned* _sqHead;
+			unsigned* _sqTail;
+			unsigned* _sqMask;
+			unsigned* _sqArray;
+			unsigned* _cqHead;
+			unsigned* _cqTail;
+			unsigned* _cqMask;
+			struct io_uring_cqe* _cqes;
+			unsigned _sqEntries;
+			/* SQEs filled but not submitted yet */
+			unsigned _toSubmit;
+			/* Connections accepted by multishot accept, not yet taken by the loop */
+			std::deque<int> _acceptedFds;
+			/* Provided buffers of multishot recv (null arena when the kernel lacks them), handed
+			 * back through a buffer ring, or by PROVIDE_BUFFERS SQEs when there is no usable ring
+			 */
+			struct io_uring_buf_ring* _bufRing;
+			char* _recvArena;
+			std::uint16_t _bufTail;
+			/* Cleared when the kernel turns multishot recv down (before 6.0) */
+			bool _multishotRecv;
+			/* Set when a buffer went back to the kernel, cleared when starved connections retry */
+			bool _recycled;
+			/* Connections whose recv stopped while the ring was empty */
+			std::vector<int> _starved;
+			/* Indexed by fd, only touched by the loop thread */
+			std::vector<_Requests> _requests;
+			/* Keyed by user_data, nodes keep their address for the kernel */
+			std::unordered_map<std::uint64_t, _Send> _sends;
+
+			_Requests& _requestsOf(int fd);
+			/* The receiving connection of ev, null when it is not or no longer one */
+			_Requests* _receiverOf(const Event& ev);
+			void _setupBufferRing();
+			/* Whether a read really takes a buffer from the registered ring */
+			bool _probeBufferRing();
+			/* Give a provided buffer back to the kernel */
+			void _recycle(std::uint16_t bid);
+			/* Forget the requests of a former connection of fd */
+			void _reset(_Requests& requests);
+			struct io_uring_sqe* _getSqe();
+			void _submit();
+			void _want(int fd, _Requests& requests, std::uint32_t kind);
+			void _unwant(int fd, _Requests& requests, std::uint32_t kind);
+			void _stop(int fd, _Requests& requests, std::uint32_t kind);
+			/* The request of kind ended, arm the next one if it is still wanted */
+			void _finish(int fd, _Requests& requests, std::uint32_t kind);
+			void _arm(int fd, _Requests& requests, std::uint32_t kind);
+			void _armPoll(int fd, std::uint32_t generation, std::uint32_t kind, bool oneShot);
+			void _armAccept(int fd);
+			void _armRecv(int fd, std::uint32_t generation);
+			void _cancel(int fd, std::uint32_t generation, std::uint32_t kind, bool oneShot);
+			long _drainReceived(int fd, _Requests& requests, char* buf, std::size_t length, Buffer* buffer);
+			void _completeRecv(int fd, std::uint32_t generation, const io_uring_cqe& cqe);
+			void _completeSend(int fd, std::uint32_t generation, const io_uring_cqe& cqe);
+			void _report(int fd, std::uint32_t generation, std::uint32_t events);
+			void _changeEvent(const Event& ev, int op);
+
+		public:
+			Multiplexer();
+			~Multiplexer();
+
+			/* Check if the running kernel provides everything this backend needs */
+			static bool isSupported();
+
+			iterator begin() override;
+			iterator end() override;
+
+			void registEvent(const Event& ev) override;
+			void unregistEvent(const Event& ev) override;
+			void rearmEvent(const Event& ev) override;
+			void releaseFd(const Event& ev) override;
+			void wait(int timeoutMs = -1) override;
+			bool takeAccepted(int& fd) override;
+			bool startReceive(const Event& ev) override;
+			bool takeReceived(const Event& ev, Buffer& buffer, long& n) override;
+			bool takeReceived(const Event& ev, char* buf, std::size_t length, long& n) override;
+			bool hasReceived(const Event& ev) const override;
+			bool submitSend(const Event& ev, const ChunkQueue& queue) override;
+			bool takeSent(const Event& ev, long& result) override;
+		};
+	}
+
+	/* Create the backend, io_uring falls back to epoll when the kernel lacks it */
+	std::unique_ptr<_MultiplexerBase> createMultiplexer(MultiplexerType type);
 }
@@ -0,0 +1,158 @@
+#include "Placement.h"
+#include "Log.h"
+#include <sched.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+namespace jrNetWork
+{
+    bool Placement::pinThread(pthread_t thread, int cpu)
+    {
+        return pinThread(thread, std::vector<int>{cpu});
+    }
+
+    bool Placement::pinThread(pthread_t thread, const std::vector<int>& cpus)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus)
+        {
+            if ((cpu >= 0) && (cpu < CPU_SETSIZE))
+            {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (CPU_COUNT(&set) == 0)
+        {
+            return false;
+        }
+        int err = ::pthread_setaffinity_np(thread, sizeof(cpu_set_t), &set);
+        if (err != 0)
+        {
+            LOGWARN() << "Pin thread failed, " << ::strerror(err) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::vector<int> Placement::allowedCpus()
+    {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (::sched_getaffinity(0, sizeof(cpu_set_t), &set) != 0)
+        {
+            LOGWARN() << "Get affinity failed, " << ::strerror(errno) << std::endl;
+            return cpus;
+        }
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    int Placement::nodeOfCpu(int cpu)
+    {
+        std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        DIR* dir = ::opendir(path.c_str());
+        if (!dir)
+        {
+            return 0;
+        }
+        int node = 0;
+        while (dirent* entry = ::readdir(dir))
+        {
+            if ((::strncmp(entry->d_name, "node", 4) == 0) && (::isdigit(entry->d_name[4])))
+            {
+                node = std::atoi(entry->d_name + 4);
+                break;
+            }
+        }
+        ::closedir(dir);
+        return node;
+    }
+
+    std::vector<int> Placement::cpusOfNode(int node)
+    {
+        /* cpulist looks like "0-3,8-11" */
+        std::vector<int> cpus;
+        std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!std::getline(in, list))
+        {
+            return cpus;
+        }
+        std::stringstream ss(list);
+        std::string range;
+        while (std::getline(ss, range, ','))
+        {
+            std::size_t dash = range.find('-');
+            int first = std::atoi(range.c_str());
+            int last = (dash == std::string::npos) ? first : std::atoi(range.c_str() + dash + 1);
+            for (int cpu = first; cpu <= last; ++cpu)
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+
+    int Placement::nodeCount()
+    {
+        /* possible looks like "0-3" */
+        std::ifstream in("/sys/devices/system/node/possible");
+        std::string list;
+        if (!std::getline(in, list) || list.empty())
+        {
+            return 1;
+        }
+        std::size_t sep = list.find_last_of("-,");
+        int last = std::atoi(list.c_str() + ((sep == std::string::npos) ? 0 : sep + 1));
+        return last + 1;
+    }
+
+    int Placement::currentNode()
+    {
+        unsigned cpu = 0;
+        unsigned node = 0;
+        if (-1 == ::syscall(SYS_getcpu, &cpu, &node, nullptr))
+        {
+            return 0;
+        }
+        return static_cast<int>(node);
+    }
+
+    bool Placement::bindMemory(void* addr, std::size_t length, int node)
+    {
+        if ((node < 0) || (node >= static_cast<int>(sizeof(unsigned long) * 8)))
+        {
+            return false;
+        }
+        unsigned long mask = 1ul << node;
+        /* The kernel reads maxnode - 1 bits of the mask */
+        if (-1 == ::syscall(SYS_mbind, addr, length, MPOL_PREFERRED, &mask, sizeof(mask) * 8 + 1, 0))
+        {
+            LOGWARN() << "Bind memory to node " << node << " failed, " << ::strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void Placement::useLocalMemory()
+    {
+        if (-1 == ::syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0))
+        {
+            LOGWARN() << "Set local memory policy failed, " << ::strerror(errno) << std::endl;
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <pthread.h>
+
+namespace jrNetWork
+{
+    /* Where the threads of an event loop run */
+    struct PlacementPolicy
+    {
+        /* CPU of loop i is loopCpus[i % size]; empty keeps the default (a lone loop floats,
+         * loops of a multi-reactor group take the i-th cpu the process may run on)
+         */
+        std::vector<int> loopCpus;
+        /* CPUs shared by the pool workers; empty for the CPUs of the loop's NUMA node */
+        std::vector<int> workerCpus;
+        /* Let every placed thread allocate from its own node, overriding an inherited interleave policy */
+        bool numaLocal = true;
+    };
+
+    namespace Placement
+    {
+        /* Pin a thread on one cpu / on a cpu set, false when refused */
+        bool pinThread(pthread_t thread, int cpu);
+        bool pinThread(pthread_t thread, const std::vector<int>& cpus);
+        /* CPUs the calling thread may run on (affinity mask and cpuset), empty when unknown */
+        std::vector<int> allowedCpus();
+        /* NUMA node of a cpu, 0 when the machine is not NUMA */
+        int nodeOfCpu(int cpu);
+        /* CPUs of a NUMA node, empty when unknown */
+        std::vector<int> cpusOfNode(int node);
+        /* Node ids run below this, 1 when the machine is not NUMA */
+        int nodeCount();
+        /* NUMA node the calling thread runs on now, 0 when unknown */
+        int currentNode();
+        /* Take the pages of a mapping from node when they are first touched, whatever the policy
+         * of the touching thread; false when refused
+         */
+        bool bindMemory(void* addr, std::size_t length, int node);
+        /* Calling thread: allocate new pages on the node it runs on */
+        void useLocalMemory();
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <algorithm>
+
+namespace jrNetWork {
+    /* Immutable, reference-counted bytes.
+     * Copies and sub-slices share one storage, so a body built once (a cached page,
+     * a canned response, a result sent to many peers) can sit in many send queues
+     * while it occupies memory once. The storage is freed with the last slice.
+     */
+    class Slice {
+    private:
+        std::shared_ptr<const std::string> _storage;
+        std::size_t _offset = 0;
+        std::size_t _length = 0;
+
+    public:
+        Slice() = default;
+
+        /* Take the bytes of data over */
+        explicit Slice(std::string data)
+            : _storage(std::make_shared<const std::string>(std::move(data)))
+            , _length(_storage->size())
+        {
+        }
+
+        explicit Slice(std::shared_ptr<const std::string> storage)
+            : _storage(std::move(storage))
+            , _length(_storage ? _storage->size() : 0)
+        {
+        }
+
+        const char* data() const { return _storage ? _storage->data() + _offset : nullptr; }
+        std::size_t size() const { return _length; }
+        bool empty() const { return _length == 0; }
+        std::string_view view() const { return std::string_view(data(), _length); }
+
+        /* Slice of length bytes from offset, sharing the storage */
+        Slice sub(std::size_t offset, std::size_t length = std::string::npos) const
+        {
+            Slice ret(*this);
+            ret._offset += std::min(offset, _length);
+            ret._length = std::min(length, _length - std::min(offset, _length));
+            return ret;
+        }
+
+        /* Owners of the storage, for statistics */
+        long useCount() const { return _storage.use_count(); }
+    };
+}
@@ -1,27 +1,39 @@
 #include "Socket.h"
 #include <fcntl.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
 #include <errno.h>
 #include <unistd.h>
 #include <cstring>
+#include <algorithm>
 #include "Log.h"
 
 namespace jrNetWork {
     TCP::Socket::Socket(IO_MODE blockingFlag)
-        : _id(::socket(AF_INET, SOCK_STREAM, 0))
+        : _id(::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0))
         , _blockingFlag(blockingFlag)
     {
         if(-1 == _id) 
         {
             throw std::string("TCP Socket create failed: ") + strerror(errno);
         }
-        int t;
-        if (-1 == ::setsockopt(_id, SOL_SOCKET, SO_REUSEADDR, &t, sizeof(t)))
+        int on = 1;
+        if (-1 == ::setsockopt(_id, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)))
         {
             throw std::string("Setsockopt with SO_REUSEADDR failed: ") + strerror(errno);
         }
     }
 
+    TCP::Socket::Socket(int id, IO_MODE blockingFlag)
+        : _id(id)
+        , _blockingFlag(blockingFlag)
+    {
+
+    }
+
     void TCP::Socket::connect(std::string ip, std::uint16_t port)
     {
         sockaddr_in addr;
@@ -48,9 +60,147 @@ namespace jrNetWork {
 
     void TCP::Socket::disconnect() 
     {
+        if (_loopOwned)
+        {
+            /* Closing here would let the fd number be reused while the loop still serves it */
+            ::shutdown(_id, SHUT_RDWR);
+            _peerClosed = true;
+            return;
+        }
         ::close(_id);
     }
 
+    void TCP::Socket::shutdown()
+    {
+        ::shutdown(_id, SHUT_WR);
+        _peerClosed = true;
+    }
+
+    void TCP::Socket::enableReusePort()
+    {
+        int on = 1;
+        if (-1 == ::setsockopt(_id, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)))
+        {
+            throw std::string("Setsockopt with SO_REUSEPORT failed: ") + strerror(errno);
+        }
+    }
+
+    bool TCP::Socket::enableBusyPoll(int usec)
+    {
+#ifdef SO_BUSY_POLL
+        if (-1 == ::setsockopt(_id, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)))
+        {
+            return false;
+        }
+#ifdef SO_PREFER_BUSY_POLL
+        int on = 1;
+        ::setsockopt(_id, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+#endif
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /* Set an int option unless it is 0, false when refused */
+    static bool setIntOption(int fd, int level, int name, int value)
+    {
+        return (value == 0) || (0 == ::setsockopt(fd, level, name, &value, sizeof(value)));
+    }
+
+    bool TCP::Socket::tuneListener(const SocketTuning& tuning)
+    {
+        /* Buffer sizes must be known before listen to pick the window scale, accepted sockets inherit them */
+        bool ok = setIntOption(_id, SOL_SOCKET, SO_RCVBUF, tuning.recvBufBytes);
+        ok = setIntOption(_id, SOL_SOCKET, SO_SNDBUF, tuning.sendBufBytes) && ok;
+        ok = setIntOption(_id, IPPROTO_TCP, TCP_DEFER_ACCEPT, tuning.deferAcceptSec) && ok;
+        ok = setIntOption(_id, IPPROTO_TCP, TCP_FASTOPEN, tuning.fastOpenQueue) && ok;
+        return ok;
+    }
+
+    bool TCP::Socket::tuneConnection(const SocketTuning& tuning)
+    {
+        bool ok = setIntOption(_id, IPPROTO_TCP, TCP_NODELAY, tuning.noDelay ? 1 : 0);
+        ok = setIntOption(_id, IPPROTO_TCP, TCP_NOTSENT_LOWAT, tuning.notSentLowat) && ok;
+        if (tuning.keepAlive)
+        {
+            ok = setIntOption(_id, SOL_SOCKET, SO_KEEPALIVE, 1) && ok;
+            ok = setIntOption(_id, IPPROTO_TCP, TCP_KEEPIDLE, tuning.keepIdleSec) && ok;
+            ok = setIntOption(_id, IPPROTO_TCP, TCP_KEEPINTVL, tuning.keepIntervalSec) && ok;
+            ok = setIntOption(_id, IPPROTO_TCP, TCP_KEEPCNT, tuning.keepCount) && ok;
+        }
+        return ok;
+    }
+
+    bool TCP::Socket::enableZeroCopy(std::size_t threshold)
+    {
+#ifdef SO_ZEROCOPY
+        int on = 1;
+        if (-1 == ::setsockopt(_id, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)))
+        {
+            return false;
+        }
+        _zeroCopyThreshold = threshold;
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    bool TCP::Socket::reapZeroCopy()
+    {
+        bool reaped = false;
+        for (;;)
+        {
+            char control[128];
+            msghdr msg;
+            ::memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (-1 == ::recvmsg(_id, &msg, MSG_ERRQUEUE | MSG_DONTWAIT))
+            {
+                break;
+            }
+            for (cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+            {
+                if (!(((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_RECVERR))
+                      || ((cm->cmsg_level == SOL_IPV6) && (cm->cmsg_type == IPV6_RECVERR))))
+                {
+                    continue;
+                }
+                const sock_extended_err* err = reinterpret_cast<const sock_extended_err*>(CMSG_DATA(cm));
+                if ((err->ee_errno != 0) || (err->ee_origin != SO_EE_ORIGIN_ZEROCOPY))
+                {
+                    continue;
+                }
+                reaped = true;
+                /* Sends [ee_info, ee_data] are done, completions come in order */
+                while (!_zeroCopyPinned.empty()
+                       && (static_cast<std::int32_t>(_zeroCopyPinned.front().first - err->ee_data) <= 0))
+                {
+                    _zeroCopyPinned.pop_front();
+                }
+                if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                {
+                    /* The kernel had to copy anyway (e.g. loopback), stop paying for the notifications */
+                    _zeroCopyThreshold = 0;
+                }
+            }
+        }
+        if (reaped)
+        {
+            return true;
+        }
+        int error = 0;
+        socklen_t len = sizeof(error);
+        return (0 == ::getsockopt(_id, SOL_SOCKET, SO_ERROR, &error, &len)) && (error == 0);
+    }
+
+    bool TCP::Socket::isZeroCopyPending() const
+    {
+        return !_zeroCopyPinned.empty();
+    }
+
     void TCP::Socket::bind(std::uint16_t port)
     {
         sockaddr_in addr;
@@ -70,165 +220,273 @@ namespace jrNetWork {
         {
             throw std::string("Listen failed: ") + strerror(errno);
         }
+        /* A non-blocking listener is drained by accept until EAGAIN */
+        if (_blockingFlag == IO_NONBLOCKING)
+        {
+            ::fcntl(_id, F_SETFL, ::fcntl(_id, F_GETFL) | O_NONBLOCK);
+        }
     }
 
     std::shared_ptr<TCP::Socket> TCP::Socket::accept() 
     {
-        int clientfd = ::accept(_id, nullptr, nullptr);
+        int clientfd = ::accept4(_id, nullptr, nullptr,
+                                 SOCK_CLOEXEC | (_blockingFlag == IO_NONBLOCKING ? SOCK_NONBLOCK : 0));
         if (-1 == clientfd) 
         {
             return nullptr;
         }
-        auto cltPtr = std::make_shared<TCP::Socket>(_blockingFlag);
-        cltPtr->_id = clientfd;
-        return cltPtr;
+        return adopt(clientfd);
+    }
+
+    std::shared_ptr<TCP::Socket> TCP::Socket::adopt(int clientfd)
+    {
+        return std::make_shared<TCP::Socket>(clientfd, _blockingFlag);
     }
 
     std::string TCP::Socket::recv(std::uint32_t length)
     {
-        int size = 0;
-        int flag = 0;
-        std::string temp(length, 0);
-        if(_blockingFlag == IO_BLOCKING) 
+        /*
+         * Serve the caller from the Buffer and refill it only when it is short. Each refill reads all
+         * the data in the system buffer at one time (to prevent the complete content from being read
+         * when epoll is set to ET), so reading a request byte by byte costs one syscall, not one per byte.
+         */
+        while (_recvBuffer.size() < length)
         {
-            for(;;)
+            /* Read ahead up to the receive cap, and always as much as the caller waits for */
+            std::size_t room = (_recvLimit > _recvBuffer.size()) ? _recvLimit - _recvBuffer.size() : 0;
+            long flag = _recvBuffer.readFd(_id, _recvLimit ? std::max<std::size_t>(room, length - _recvBuffer.size()) : SIZE_MAX);
+            if (flag > 0)
             {
-                if (size == length)
-                {
-                    break;
-                }
-                flag = ::recv(_id, &temp[size], length - size, 0);
-                if (flag < 0)
-                {
-                    if (errno != EINTR)
-                    {
-                        LOGNOTICE() << "Blocking, errno = " << errno << std::endl;
-                        break;
-                    }
-                }
-                else if (flag == 0)
-                {
-                    LOGNOTICE() << "Blocking, peer is closed." << std::endl;
-                    break;
-                } 
-                else
-                {
-                    size += flag;
-                }
+                continue;
             }
-            return temp;
-        } 
-        else 
-        {
-            /*
-             * Read all the data in the system buffer at one time and store it in the Buffer
-             * (to prevent the complete content from being read when epoll is set to ET),
-             * the user actually reads the specified length of data from the Buffer.
-             */
-            for (;;)
+            if (flag == 0)
             {
-                if (size == length)
-                {
-                    break;
-                }
-                flag = ::recv(_id, &temp[size], length - size, MSG_DONTWAIT);
-                if(flag < 0)
-                {
-                    if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
-                    {
-                        LOGNOTICE() << "Nonblocking, errno = " << errno << " continue" << std::endl;
-                        continue;
-                    } 
-                    else 
-                    {
-                        LOGNOTICE() << "Nonblocking, errno = " << errno << " break" << std::endl;
-                        break;
-                    }
-                } 
-                else if(flag == 0)
-                {
-                    LOGNOTICE() << "Nonblocking, peer is closed." << std::endl;
-                    break;
-                } 
-                else 
-                {
-                    _recvBuffer.append(temp.begin() + size, temp.begin() + size + flag);
-                    size += flag;
-                }
+                LOGNOTICE() << "Peer is closed." << std::endl;
+                _peerClosed = true;
+                break;
             }
-            return _recvBuffer.getData(length);
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if ((_blockingFlag == IO_NONBLOCKING) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+            {
+                /* The caller asked for length bytes, wait for the rest */
+                continue;
+            }
+            LOGNOTICE() << "Recv failed, errno = " << errno << std::endl;
+            _peerClosed = true;
+            break;
         }
+        std::string ret = _recvBuffer.getData(length);
+        if (_recvLimit)
+        {
+            if (!_recvPaused && (_recvBuffer.size() + ret.size() >= _recvLimit))
+            {
+                _recvPaused = true;
+            }
+            if (_recvPaused && (_recvBuffer.size() < _recvResume))
+            {
+                _recvPaused = false;
+            }
+        }
+        return ret;
+    }
+
+    void TCP::Socket::setRecvLimit(std::size_t limit, std::size_t resumeBelow)
+    {
+        _recvLimit = limit;
+        _recvResume = std::min(resumeBelow, limit);
+        _recvPaused = false;
+    }
+
+    std::size_t TCP::Socket::bufferedBytes() const
+    {
+        return _recvBuffer.size();
+    }
+
+    bool TCP::Socket::isRecvPaused() const
+    {
+        return _recvPaused;
+    }
+
+    std::size_t TCP::Socket::releaseIdleMemory()
+    {
+        return _recvBuffer.shrink();
     }
 
     bool TCP::Socket::send(std::string data) 
     {
-        int length = data.length();
-        const char* data_c = data.c_str();
-        if(_blockingFlag == IO_BLOCKING) 
+        std::vector<std::string> chunks;
+        chunks.push_back(std::move(data));
+        return send(std::move(chunks));
+    }
+
+    bool TCP::Socket::send(std::vector<std::string> chunks)
+    {
+        ChunkQueue queue;
+        for (auto& chunk : chunks)
         {
-            /* Insure complete sent data
-             * After sending, check whether the number of bytes sent is equal to the number of data bytes,
-             * if not, continue sending until all data is sent.
-             */
-            for(int size = 0; size < length; ) 
+            queue.push(std::move(chunk));
+        }
+        return send(std::move(queue));
+    }
+
+    bool TCP::Socket::send(Slice data)
+    {
+        ChunkQueue queue;
+        queue.push(std::move(data));
+        return send(std::move(queue));
+    }
+
+    bool TCP::Socket::send(ChunkQueue chunks)
+    {
+        _sendBuffer.append(std::move(chunks));
+        return flush();
+    }
+
+    bool TCP::Socket::flush()
+    {
+        /* Blocking mode insures complete sent data, non-blocking mode stops when the socket buffer is full
+         * and the rest waits in the queue for EPOLLOUT
+         */
+        while (!_sendBuffer.empty())
+        {
+            long flag = _sendOnce(_sendBuffer, (_blockingFlag == IO_NONBLOCKING) ? MSG_DONTWAIT : 0);
+            if ((flag < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
             {
-                int flag = ::send(_id, data_c + size, length - size, 0);
-                if(flag == -1) 
-                {
-                    if(errno != EINTR) 
-                    {
-                        return false;
-                    } 
-                    else 
-                    {
-                        continue;
-                    }
-                } 
-                else if(flag == 0) 
-                {
-                    break;
-                }
-                size += flag;
+                break;
+            }
+            if ((flag == 0) || ((flag < 0) && (errno != EINTR)))
+            {
+                _peerClosed = true;
+                return false;
+            }
+        }
+        _checkWaterMarks();
+        return true;
+    }
+
+    void TCP::Socket::setWaterMarks(std::size_t highWater, std::size_t lowWater,
+                                    std::function<void()> onHighWater, std::function<void()> onDrained)
+    {
+        _highWaterMark = highWater;
+        _lowWaterMark = std::min(lowWater, highWater ? highWater - 1 : 0);
+        _onHighWater = std::move(onHighWater);
+        _onDrained = std::move(onDrained);
+        _aboveHighWater = false;
+    }
+
+    void TCP::Socket::_checkWaterMarks()
+    {
+        if (_highWaterMark == 0)
+        {
+            return;
+        }
+        /* The state changes before the callback, which may send or flush again */
+        if (!_aboveHighWater && (_sendBuffer.size() >= _highWaterMark))
+        {
+            _aboveHighWater = true;
+            if (_onHighWater)
+            {
+                _onHighWater();
             }
-        } 
-        else 
+        }
+        else if (_aboveHighWater && (_sendBuffer.size() <= _lowWaterMark))
         {
-            /* Send data */
-            std::size_t sent_size = 0;
-            while(true) 
+            _aboveHighWater = false;
+            if (_onDrained)
             {
-                int flag = ::send(_id, data_c, length - sent_size, MSG_DONTWAIT);
-                if(flag < 0) 
-                {
-                    if(errno == EAGAIN || errno == EWOULDBLOCK) 
-                    {
-                        break;
-                    } 
-                    else if(errno == EINTR) 
-                    {
-                        continue;
-                    } 
-                    else 
-                    {
-                        break;
-                    }
-                } 
-                else if(flag == 0) 
+                _onDrained();
+            }
+        }
+    }
+
+    std::size_t TCP::Socket::pendingBytes() const
+    {
+        return _sendBuffer.size();
+    }
+
+    bool TCP::Socket::isAboveHighWater() const
+    {
+        return _aboveHighWater;
+    }
+
+    long TCP::Socket::_sendOnce(ChunkQueue& queue, int flags)
+    {
+        int fd;
+        off_t offset;
+        std::size_t length;
+        long n;
+        if (queue.frontFile(fd, offset, length))
+        {
+            /* sendfile honours O_NONBLOCK only, the flags of a blocking socket need no help */
+            n = ::sendfile(_id, fd, &offset, length);
+        }
+        else
+        {
+            iovec iov[ChunkQueue::eMaxIov];
+            msghdr msg;
+            ::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = queue.fillIov(iov, ChunkQueue::eMaxIov);
+            Slice pinned;
+            if (_zeroCopyThreshold && (iov[0].iov_len >= _zeroCopyThreshold))
+            {
+                /* A large chunk goes alone, so exactly its buffer is pinned until the completion */
+                msg.msg_iovlen = 1;
+                pinned = queue.frontData();
+                n = ::sendmsg(_id, &msg, flags | MSG_NOSIGNAL | MSG_ZEROCOPY);
+                if (n > 0)
                 {
-                    break;
-                } 
-                else 
+                    _zeroCopyPinned.emplace_back(_zeroCopySeq++, std::move(pinned));
+                }
+                else if ((n < 0) && (errno == ENOBUFS))
                 {
-                    sent_size += flag;
+                    /* Out of option memory for notifications, copy this time */
+                    n = ::sendmsg(_id, &msg, flags | MSG_NOSIGNAL);
                 }
             }
-            /* Part of it is sent, and the remainder is added to the buffer */
-            if(sent_size < data.length()) 
+            else
             {
-                _sendBuffer.append(data.begin()+sent_size, data.end());
+                n = ::sendmsg(_id, &msg, flags | MSG_NOSIGNAL);
             }
         }
-        return true;
+        if (n > 0)
+        {
+            queue.consume(n);
+        }
+        return n;
+    }
+
+    long TCP::Socket::recvSome(Buffer& buffer)
+    {
+        long n = buffer.readFd(_id);
+        if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)))
+        {
+            _peerClosed = true;
+        }
+        return n;
+    }
+
+    long TCP::Socket::recvSome(char* buf, std::size_t length)
+    {
+        long n = ::recv(_id, buf, length, MSG_DONTWAIT);
+        if ((n == 0) || ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR)))
+        {
+            _peerClosed = true;
+        }
+        return n;
+    }
+
+    long TCP::Socket::sendSome(ChunkQueue& queue)
+    {
+        long n = _sendOnce(queue, MSG_DONTWAIT);
+        if ((n < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+        {
+            _peerClosed = true;
+        }
+        return n;
     }
 
     bool TCP::Socket::isSendAll() const 
@@ -236,6 +494,11 @@ namespace jrNetWork {
         return _sendBuffer.empty();
     }
 
+    bool TCP::Socket::isPeerClosed() const
+    {
+        return _peerClosed;
+    }
+
     std::string TCP::Socket::get_ip_from_socket() const 
     {
         std::string address;
@@ -1,8 +1,13 @@
 #pragma once
 
 #include "Buffer.h"
+#include "ChunkQueue.h"
+#include "SocketTuning.h"
 #include <memory>
 #include <string>
+#include <vector>
+#include <deque>
+#include <functional>
 #include <cstdint>
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -21,29 +26,143 @@ namespace jrNetWork {
         private:
             int _id;
             IO_MODE _blockingFlag;
-            Buffer _recvBuffer, _sendBuffer;
+            /* Set by recv/send when peer closed or the connection broke */
+            bool _peerClosed = false;
+            /* Set by the event loop serving the connection, which closes the fd itself */
+            bool _loopOwned = false;
+            Buffer _recvBuffer;
+            /* Receive cap: recv reads ahead only up to recvLimit buffered bytes, and the connection
+             * counts as paused from there until it is consumed below the resume mark. 0 for off.
+             */
+            std::size_t _recvLimit = 0;
+            std::size_t _recvResume = 0;
+            bool _recvPaused = false;
+            /* Kept by the event loop while it runs the read handler on buffered input: whether the
+             * fd is not watched for input, and what was buffered before the last round
+             */
+            bool _readDisarmed = false;
+            std::size_t _fedBytes = SIZE_MAX;
+            /* Unsent chunks, in order */
+            ChunkQueue _sendBuffer;
+            /* Zero copy: chunks from this size on are sent with MSG_ZEROCOPY (0 for off), and the
+             * buffers stay pinned with the sequence number of their send until the kernel reports
+             * the completion on the error queue
+             */
+            std::size_t _zeroCopyThreshold = 0;
+            std::uint32_t _zeroCopySeq = 0;
+            std::deque<std::pair<std::uint32_t, Slice> > _zeroCopyPinned;
+            /* Backpressure on the unsent chunks: reaching the high-water mark calls onHighWater once,
+             * draining down to the low-water mark calls onDrained. 0 for off.
+             */
+            std::size_t _highWaterMark = 0;
+            std::size_t _lowWaterMark = 0;
+            bool _aboveHighWater = false;
+            std::function<void()> _onHighWater;
+            std::function<void()> _onDrained;
+
+            /* Fire the water-mark callback the queued size has crossed into */
+            void _checkWaterMarks();
+            /* One write from the front of queue, consumes what was written */
+            long _sendOnce(ChunkQueue& queue, int flags);
 
         public:
             /* Create socket file description */
             Socket(IO_MODE blockingFlag = IO_NONBLOCKING);
+            /* Wrap an already connected file description */
+            Socket(int id, IO_MODE blockingFlag);
             /* Connect to server */
             void connect(std::string ip, std::uint16_t port);
-            /* Close current connection */
+            /* Close current connection. On a connection served by an event loop it is shut down
+             * and marked closed instead, the loop releases the fd once the handler returns.
+             */
             void disconnect();
+            /* Finish sending (FIN after what is written) and mark the connection closed, so the
+             * event loop serving it releases it
+             */
+            void shutdown();
+            /* Allow several sockets to bind the same port (SO_REUSEPORT) */
+            void enableReusePort();
+            /* Let the kernel busy poll the device queue for usec on blocking reads (SO_BUSY_POLL,
+             * SO_PREFER_BUSY_POLL where available), false when not permitted or not supported
+             */
+            bool enableBusyPoll(int usec);
+            /* Apply the listener / connection part of a tuning profile, false when an option
+             * was refused (the others are applied anyway)
+             */
+            bool tuneListener(const SocketTuning& tuning);
+            bool tuneConnection(const SocketTuning& tuning);
+            /* Send chunks of at least threshold bytes without copying them (SO_ZEROCOPY),
+             * false when the kernel does not support it
+             */
+            bool enableZeroCopy(std::size_t threshold);
+            /* Release the buffers of completed zero-copy sends from the error queue,
+             * false when the socket reported a real error instead
+             */
+            bool reapZeroCopy();
+            /* Zero-copy sends the kernel has not completed yet */
+            bool isZeroCopyPending() const;
             /* Bind ip address and port */
             void bind(std::uint16_t port);
             /* Listen target port */
             void listen(int backlog = 5);
-            /* Accept client connection */
+            /* Accept client connection (non-blocking and close-on-exec for a non-blocking listener),
+             * null on failure with errno set
+             */
             std::shared_ptr<TCP::Socket> accept();
-            /* Receive data frome stream by length */
+            /* Wrap a client connection accepted elsewhere (e.g. by io_uring) */
+            std::shared_ptr<TCP::Socket> adopt(int clientfd);
+            /* Receive data frome stream by length, what is read beyond it stays buffered for the next call */
             std::string recv(std::uint32_t length);
+            /* Bound what recv buffers ahead to limit bytes; reaching it pauses the connection until
+             * the buffered input drops below resumeBelow. limit 0 turns it off.
+             */
+            void setRecvLimit(std::size_t limit, std::size_t resumeBelow);
+            /* Input buffered by recv and not consumed yet */
+            std::size_t bufferedBytes() const;
+            /* Between reaching the receive cap and being consumed below the resume mark */
+            bool isRecvPaused() const;
+            /* Shrink the receive buffer of a quiet connection, see Buffer::shrink; returns the bytes freed */
+            std::size_t releaseIdleMemory();
             /* Write data to stream */
             bool send(std::string data);
+            /* Write chunks to stream with gather writes, without merging them.
+             * In non-blocking mode what the socket does not take is queued for flush.
+             */
+            bool send(std::vector<std::string> chunks);
+            /* Write shared bytes, queued without a copy when the socket does not take them at once */
+            bool send(Slice data);
+            /* Write a prepared queue, which may hold file ranges sent by sendfile */
+            bool send(ChunkQueue chunks);
+            /* Write the queued chunks, false when the connection broke */
+            bool flush();
+            /* Bound the output queued by send: once highWater bytes are pending onHighWater is called,
+             * and onDrained when flushing brings them down to lowWater. They run on the thread which
+             * sends or flushes, inside that call. highWater 0 turns it off.
+             */
+            void setWaterMarks(std::size_t highWater, std::size_t lowWater,
+                               std::function<void()> onHighWater, std::function<void()> onDrained);
+            /* Bytes queued by send and not written yet */
+            std::size_t pendingBytes() const;
+            /* Between crossing the high-water mark and draining to the low-water mark */
+            bool isAboveHighWater() const;
+            /* One non-blocking read of at most length bytes: the bytes read, 0 when peer closed,
+             * -1 with errno set (EAGAIN when nothing is pending)
+             */
+            long recvSome(char* buf, std::size_t length);
+            /* One read of everything pending into buffer (a non-blocking socket does not wait),
+             * same results as above
+             */
+            long recvSome(Buffer& buffer);
+            /* One non-blocking write from the front of queue (a gather write, or sendfile for a file range),
+             * consumes and returns the bytes written, or -1 with errno set (EAGAIN when the buffer is full)
+             */
+            long sendSome(ChunkQueue& queue);
             /* Determine whether the data has been sent
              * (the return value is only meaningful for non-blocking mode)
              */
             bool isSendAll() const;
+            /* Check if peer has closed the connection (seen by the last recv/send) */
+            bool isPeerClosed() const;
             /* Get current socket's ip address */
             std::string get_ip_from_socket() const;
         };
@@ -0,0 +1,65 @@
+#include "SocketTuning.h"
+
+namespace jrNetWork
+{
+    SocketTuning SocketTuning::latency()
+    {
+        SocketTuning tuning;
+        tuning.noDelay = true;
+        tuning.deferAcceptSec = 1;
+        tuning.fastOpenQueue = 256;
+        tuning.keepAlive = true;
+        tuning.keepIdleSec = 60;
+        tuning.keepIntervalSec = 10;
+        tuning.keepCount = 5;
+        tuning.notSentLowat = 16 * 1024;
+        return tuning;
+    }
+
+    SocketTuning SocketTuning::throughput()
+    {
+        SocketTuning tuning;
+        tuning.noDelay = true;
+        tuning.deferAcceptSec = 1;
+        tuning.fastOpenQueue = 256;
+        tuning.keepAlive = true;
+        tuning.keepIdleSec = 120;
+        tuning.keepIntervalSec = 30;
+        tuning.keepCount = 4;
+        tuning.notSentLowat = 128 * 1024;
+        return tuning;
+    }
+
+    SocketTuning SocketTuning::bulk()
+    {
+        SocketTuning tuning;
+        tuning.recvBufBytes = 1 << 20;
+        tuning.sendBufBytes = 4 << 20;
+        tuning.keepAlive = true;
+        tuning.keepIdleSec = 300;
+        tuning.keepIntervalSec = 60;
+        tuning.keepCount = 4;
+        return tuning;
+    }
+
+    SocketTuning SocketTuning::byName(const std::string& name)
+    {
+        if (name == "latency")
+        {
+            return latency();
+        }
+        if (name == "throughput")
+        {
+            return throughput();
+        }
+        if (name == "bulk")
+        {
+            return bulk();
+        }
+        if (name == "default")
+        {
+            return SocketTuning();
+        }
+        throw std::string("Unknown socket tuning profile: ") + name;
+    }
+}
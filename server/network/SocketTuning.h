@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+namespace jrNetWork
+{
+    /* Socket options a loop applies to its listener and the connections it accepts.
+     * 0 / false leaves the kernel default.
+     */
+    struct SocketTuning
+    {
+        /* Connections: send small writes at once instead of waiting for Nagle (TCP_NODELAY) */
+        bool noDelay = false;
+        /* Listener: wake accept only when data arrives, waiting at most deferAcceptSec (TCP_DEFER_ACCEPT) */
+        int deferAcceptSec = 0;
+        /* Listener: queue length of TCP Fast Open requests (TCP_FASTOPEN) */
+        int fastOpenQueue = 0;
+        /* Listener, inherited by the connections: buffer sizes (SO_RCVBUF/SO_SNDBUF),
+         * setting them turns the kernel's autotuning off
+         */
+        int recvBufBytes = 0;
+        int sendBufBytes = 0;
+        /* Connections: drop peers which stay silent (SO_KEEPALIVE, TCP_KEEPIDLE/KEEPINTVL/KEEPCNT) */
+        bool keepAlive = false;
+        int keepIdleSec = 0;
+        int keepIntervalSec = 0;
+        int keepCount = 0;
+        /* Connections: report writable only when less than this is unsent (TCP_NOTSENT_LOWAT) */
+        int notSentLowat = 0;
+
+        /* Small request/response traffic: no Nagle, shallow send queue */
+        static SocketTuning latency();
+        /* Many mid-sized responses: no Nagle, autotuned buffers, deeper send queue */
+        static SocketTuning throughput();
+        /* Large transfers: big fixed buffers, Nagle left on to fill segments */
+        static SocketTuning bulk();
+        /* Profile by name: "latency", "throughput", "bulk" or "default", throws on other names */
+        static SocketTuning byName(const std::string& name);
+    };
+}
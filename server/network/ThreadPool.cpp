@@ -1,19 +1,26 @@
 #include "ThreadPool.h"
+#include <signal.h>
+#include <pthread.h>
+#include "Placement.h"
 
 namespace jrNetWork {
-    ThreadPool::ThreadPool(std::uint16_t maxPoolSize) 
+    ThreadPool::ThreadPool(std::uint16_t maxPoolSize, std::vector<int> cpus) 
         : _stop(false)
         , _candidateThreads(new std::thread[maxPoolSize], [](std::thread* t) { if (t->joinable()) { t->join(); } })
+        , _cpus(std::move(cpus))
     {
         for (std::size_t i = 0; i < maxPoolSize; ++i)
         {
-            _candidateThreads[i] = std::move(std::thread(&ThreadPool::run, this));
+            _candidateThreads[i] = std::move(std::thread(&ThreadPool::run, this, i));
         }
     }
 
     ThreadPool::~ThreadPool() 
     {
-        _stop = true;    
+        {
+            std::lock_guard<std::mutex> lock(_mutexLock);
+            _stop = true;
+        }
         _condition.notify_all();
     }
 
@@ -25,19 +32,37 @@ namespace jrNetWork {
         _condition.notify_one();
     }
 
-    void ThreadPool::run() 
+    void ThreadPool::run(std::size_t idx) 
     {
+        // Pin before the first task so the worker's allocations land on its node
+        if (!_cpus.empty())
+        {
+            Placement::pinThread(::pthread_self(), _cpus[idx % _cpus.size()]);
+        }
+        // Workers never take asynchronous signals, the event loop reads them from its signalfd
+        sigset_t set;
+        ::sigfillset(&set);
+        ::sigdelset(&set, SIGSEGV);
+        ::sigdelset(&set, SIGBUS);
+        ::sigdelset(&set, SIGFPE);
+        ::sigdelset(&set, SIGILL);
+        ::pthread_sigmask(SIG_BLOCK, &set, nullptr);
         for(;;)
         {
-            std::unique_lock<std::mutex> waitLock(_mutexLock);
-            if(_stop) break;
-            // Blocking thread when task queue is empty
-            while (_taskQueue.empty())
+            TaskType task;
             {
-                _condition.wait(waitLock);
+                std::unique_lock<std::mutex> waitLock(_mutexLock);
+                // Blocking thread when task queue is empty
+                while (!_stop && _taskQueue.empty())
+                {
+                    _condition.wait(waitLock);
+                }
+                if(_stop) break;
+                task = std::move(_taskQueue.front());
+                _taskQueue.pop();
             }
-            _taskQueue.front()();  // Run task
-            _taskQueue.pop();
+            // Run task without the lock, tasks of one connection never overlap
+            task();
         }
     }
 }
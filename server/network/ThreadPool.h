@@ -3,6 +3,7 @@
 #include <queue>
 #include <mutex>
 #include <memory>
+#include <vector>
 #include <atomic>
 #include <thread>
 #include <cstdint>
@@ -26,13 +27,15 @@ namespace jrNetWork {
         std::queue<TaskType> _taskQueue;
         /* Task queue mutex */
         mutable std::mutex _mutexLock;
+        /* Worker i runs on _cpus[i % size], empty for no pinning */
+        std::vector<int> _cpus;
 
     private:
         /* Run task */
-        void run();
+        void run(std::size_t idx);
 
     public:
-        ThreadPool(std::uint16_t maxPoolSize);
+        ThreadPool(std::uint16_t maxPoolSize, std::vector<int> cpus = {});
         ~ThreadPool();
 
         void addTask(TaskType task);
@@ -1,86 +1,315 @@
 #pragma once
 
-#include <set>
-#include <memory>
+#include <array>
+#include <algorithm>
+#include <vector>
 #include <chrono>
-#include <functional>
-#include <unistd.h>
+#include <cstdint>
+#include <climits>
+#include <utility>
 
 namespace jrNetWork {
 
+    /* Reference to a timer: node index plus the node generation when it was handed out */
+    struct TimerHandle
+    {
+        std::int32_t index = -1;
+        std::uint32_t generation = 0;
+
+        explicit operator bool() const { return index >= 0; }
+    };
 
-    /* Timer container */
-    template<class SocketType>
-    class TimerContainer 
+    /* Timer container: hierarchical timing wheel with millisecond resolution.
+     * Level 0 has 256 one-millisecond slots, each of the 4 upper levels has 64 slots
+     * covering 64 times the span of the level below (about 49 days in total).
+     * Timers are nodes of an intrusive doubly linked list kept in a pooled vector and
+     * recycled through a free list, so add, refresh and cancel are O(1) and do not
+     * allocate once the pool has grown to the working set.
+     * Only the owner thread (the event loop) may touch it.
+     */
+    template<class PayloadType>
+    class TimerContainer
     {
     private:
-        using CltPtrType = std::shared_ptr<SocketType>;
-        using TimeoutCallbackType = std::function<void(CltPtrType)>;
-        using TimePonitType = std::chrono::time_point<std::chrono::steady_clock>;
-        struct _TimerInfo
-        {
-            CltPtrType cltPtr;
-            TimePonitType time;
-
-            _TimerInfo(CltPtrType c, std::uint16_t timeoutMs) 
-                : cltPtr(c)
-                , time(std::chrono::steady_clock::now()
-                + std::chrono::duration<std::uint16_t, std::ratio<1>>(timeoutMs))
-            {}
-
-            bool operator<(const _TimerInfo& rhs) const { return time < rhs.time; }
-            bool operator<=(const _TimerInfo& rhs) const { return time <= rhs.time; }
-            bool operator>(const _TimerInfo& rhs) const { return time > rhs.time; }
-            bool operator>=(const _TimerInfo& rhs) const { return time >= rhs.time; }
-            bool operator==(const _TimerInfo& rhs) const { return time == rhs.time; }
-            bool operator!=(const _TimerInfo& rhs) const { return time != rhs.time; }
+        using ClockType = std::chrono::steady_clock;
+
+        static constexpr int eRootBits = 8;
+        static constexpr int eLevelBits = 6;
+        static constexpr int eLevelNum = 4;
+        static constexpr std::uint32_t eRootSize = 1u << eRootBits;
+        static constexpr std::uint32_t eLevelSize = 1u << eLevelBits;
+        static constexpr std::uint64_t eMaxDelay = (1ull << (eRootBits + eLevelNum * eLevelBits)) - 1;
+        /* All level slots, plus the list being expired right now */
+        static constexpr std::uint32_t eSlotNum = eRootSize + eLevelNum * eLevelSize;
+        static constexpr std::uint32_t eExpiringSlot = eSlotNum;
+        static constexpr std::int32_t eNil = -1;
+
+        struct _TimerNode
+        {
+            PayloadType payload;
+            std::uint64_t expire = 0;
+            std::int32_t prev = eNil;
+            std::int32_t next = eNil;
+            /* Slot list which holds the node, eNil when the node is free */
+            std::int32_t slot = eNil;
+            std::uint32_t generation = 0;
         };
 
     private:
-        std::uint16_t _timeoutMs = 0;
-        /* Base container */
-        std::set<_TimerInfo> _container;
-        /* Get the min timer */
-        const _TimerInfo& getMin() const { return *(_container.begin()); }
-        /* Check have or have not timer */
-        bool isEmpty() const { return _container.empty(); }
+        ClockType::time_point _epoch;
+        /* Next tick (ms since _epoch) to be expired */
+        std::uint64_t _current = 0;
+        std::size_t _size = 0;
+        std::vector<_TimerNode> _nodes;
+        std::int32_t _freeHead = eNil;
+        std::array<std::int32_t, eSlotNum + 1> _slots;
 
-    public:
-        TimerContainer() = default;
+        std::uint64_t _nowTick() const
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(ClockType::now() - _epoch).count();
+        }
+
+        /* Slot of an expire tick, relative to the current tick */
+        std::uint32_t _slotOf(std::uint64_t expire) const
+        {
+            std::uint64_t delta = expire - _current;
+            if (delta < eRootSize)
+            {
+                return expire & (eRootSize - 1);
+            }
+            for (int level = 1; level <= eLevelNum; ++level)
+            {
+                if ((level == eLevelNum) || (delta < (1ull << (eRootBits + level * eLevelBits))))
+                {
+                    std::uint64_t idx = (expire >> (eRootBits + (level - 1) * eLevelBits)) & (eLevelSize - 1);
+                    return eRootSize + (level - 1) * eLevelSize + static_cast<std::uint32_t>(idx);
+                }
+            }
+            return 0;
+        }
+
+        void _link(std::int32_t idx, std::uint32_t slot)
+        {
+            _TimerNode& node = _nodes[idx];
+            node.slot = static_cast<std::int32_t>(slot);
+            node.prev = eNil;
+            node.next = _slots[slot];
+            if (node.next != eNil)
+            {
+                _nodes[node.next].prev = idx;
+            }
+            _slots[slot] = idx;
+        }
+
+        void _unlink(std::int32_t idx)
+        {
+            _TimerNode& node = _nodes[idx];
+            if (node.prev != eNil)
+            {
+                _nodes[node.prev].next = node.next;
+            }
+            else
+            {
+                _slots[node.slot] = node.next;
+            }
+            if (node.next != eNil)
+            {
+                _nodes[node.next].prev = node.prev;
+            }
+            node.prev = node.next = eNil;
+        }
+
+        /* Put a node into the wheel, a past expire fires on the next tick */
+        void _schedule(std::int32_t idx, std::uint64_t expire)
+        {
+            if (expire < _current)
+            {
+                expire = _current;
+            }
+            if (expire - _current > eMaxDelay)
+            {
+                expire = _current + eMaxDelay;
+            }
+            _nodes[idx].expire = expire;
+            _link(idx, _slotOf(expire));
+        }
 
-        void startCount(std::uint16_t timeoutMs)
+        std::int32_t _allocNode()
         {
-            _timeoutMs = timeoutMs;
-            ::alarm(timeoutMs);
+            std::int32_t idx = _freeHead;
+            if (idx != eNil)
+            {
+                _freeHead = _nodes[idx].next;
+                _nodes[idx].next = eNil;
+            }
+            else
+            {
+                idx = static_cast<std::int32_t>(_nodes.size());
+                _nodes.emplace_back();
+            }
+            ++_size;
+            return idx;
         }
 
-        /* Add a timer into container */
-        void addTask(CltPtrType cltPtr)
+        void _freeNode(std::int32_t idx)
         {
-            _container.emplace(cltPtr, _timeoutMs);
+            _TimerNode& node = _nodes[idx];
+            node.slot = eNil;
+            node.payload = PayloadType();
+            ++node.generation;
+            node.next = _freeHead;
+            _freeHead = idx;
+            --_size;
         }
 
-        /* Delte processed timer from container top */
-        void delTask()
+        bool _isCurrent(const TimerHandle& h) const
         {
-            _container.erase(_container.begin());
+            return (h.index >= 0) && (static_cast<std::size_t>(h.index) < _nodes.size())
+                && (_nodes[h.index].generation == h.generation) && (_nodes[h.index].slot != eNil);
         }
 
-        /* Check timers in heap, exec timeout timer's handler */
-        void tick(TimeoutCallbackType callback)
+        /* Move the timers of an upper level slot down to where they belong now,
+         * returns the slot index so the caller knows whether the next level wrapped too
+         */
+        std::uint32_t _cascade(int level)
         {
-            while (!isEmpty())
+            std::uint32_t idx = (_current >> (eRootBits + (level - 1) * eLevelBits)) & (eLevelSize - 1);
+            std::uint32_t slot = eRootSize + (level - 1) * eLevelSize + idx;
+            std::int32_t node = _slots[slot];
+            _slots[slot] = eNil;
+            while (node != eNil)
             {
-                /* Min element NOT timeout */
-                if (std::chrono::steady_clock::now() < getMin().time)
+                std::int32_t next = _nodes[node].next;
+                _nodes[node].prev = _nodes[node].next = eNil;
+                _link(node, _slotOf(_nodes[node].expire));
+                node = next;
+            }
+            return idx;
+        }
+
+    public:
+        TimerContainer()
+            : _epoch(ClockType::now())
+        {
+            _slots.fill(eNil);
+        }
+
+        /* Number of pending timers */
+        std::size_t size() const { return _size; }
+
+        /* Milliseconds until the next timer expires or the next cascade is due, -1 when there is no timer */
+        int nextTimeout() const
+        {
+            if (_size == 0)
+            {
+                return -1;
+            }
+            std::uint64_t deadline = UINT64_MAX;
+            for (std::uint64_t t = _current; t < _current + eRootSize; ++t)
+            {
+                if (_slots[t & (eRootSize - 1)] != eNil)
                 {
+                    deadline = t;
                     break;
                 }
-                callback(getMin().cltPtr);
-                /* Timeout */
-                delTask();
             }
-            startCount(_timeoutMs); // Reset alarm
+            for (int level = 1; level <= eLevelNum; ++level)
+            {
+                int shift = eRootBits + (level - 1) * eLevelBits;
+                const std::int32_t* slots = &_slots[eRootSize + (level - 1) * eLevelSize];
+                std::uint64_t block = _current >> shift;
+                /* The slot of the current block is cascaded when the block starts */
+                std::uint64_t k = ((_current & ((1ull << shift) - 1)) == 0) ? 0 : 1;
+                for (; k <= eLevelSize; ++k)
+                {
+                    if (slots[(block + k) & (eLevelSize - 1)] != eNil)
+                    {
+                        deadline = std::min(deadline, (block + k) << shift);
+                        break;
+                    }
+                }
+            }
+            std::uint64_t now = _nowTick();
+            return (deadline <= now) ? 0 : static_cast<int>(std::min<std::uint64_t>(deadline - now, INT32_MAX));
+        }
+
+        /* Add a timer which expires after delay */
+        TimerHandle add(PayloadType payload, std::chrono::milliseconds delay)
+        {
+            std::int32_t idx = _allocNode();
+            _nodes[idx].payload = std::move(payload);
+            _schedule(idx, _nowTick() + static_cast<std::uint64_t>(std::max<std::int64_t>(delay.count(), 0)));
+            TimerHandle h;
+            h.index = idx;
+            h.generation = _nodes[idx].generation;
+            return h;
+        }
+
+        /* Push the expiry of a pending timer to now + delay, or add a new one when the handle is stale */
+        TimerHandle refresh(const TimerHandle& h, PayloadType payload, std::chrono::milliseconds delay)
+        {
+            if (!_isCurrent(h))
+            {
+                return add(std::move(payload), delay);
+            }
+            _unlink(h.index);
+            _schedule(h.index, _nowTick() + static_cast<std::uint64_t>(std::max<std::int64_t>(delay.count(), 0)));
+            return h;
+        }
+
+        /* Remove a pending timer, false when it has expired or was cancelled already */
+        bool cancel(const TimerHandle& h)
+        {
+            if (!_isCurrent(h))
+            {
+                return false;
+            }
+            _unlink(h.index);
+            _freeNode(h.index);
+            return true;
+        }
+
+        /* Expire every timer due by now, callback(const PayloadType&) may add, refresh or cancel timers */
+        template<typename F>
+        void tick(F&& callback)
+        {
+            std::uint64_t target = _nowTick();
+            if (_size == 0)
+            {
+                _current = target + 1;
+                return;
+            }
+            while (_current <= target)
+            {
+                std::uint32_t idx = _current & (eRootSize - 1);
+                if (idx == 0)
+                {
+                    for (int level = 1; (level <= eLevelNum) && (_cascade(level) == 0); ++level)
+                    {
+                    }
+                }
+                /* Detach the due list first, timers added by callbacks land in later slots */
+                std::int32_t node = _slots[idx];
+                _slots[idx] = eNil;
+                _slots[eExpiringSlot] = node;
+                for (std::int32_t i = node; i != eNil; i = _nodes[i].next)
+                {
+                    _nodes[i].slot = eExpiringSlot;
+                }
+                ++_current;
+                while (_slots[eExpiringSlot] != eNil)
+                {
+                    std::int32_t first = _slots[eExpiringSlot];
+                    _unlink(first);
+                    PayloadType payload = std::move(_nodes[first].payload);
+                    _freeNode(first);
+                    callback(payload);
+                }
+                if (_size == 0)
+                {
+                    _current = target + 1;
+                }
+            }
         }
     };
 }
@@ -1,52 +1,54 @@
 #include "Ues.h"
 #include "Log.h"
-#include <signal.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <cstring>
-#include <sys/socket.h>
+#include <pthread.h>
+#include <sys/signalfd.h>
 
 namespace jrNetWork
 {
-    int _UnifiedEventSource::_uesfd[2] = {0, 0};
+    int _UnifiedEventSource::_signalFd = -1;
+    sigset_t _UnifiedEventSource::_sigMask;
+    int _UnifiedEventSource::_refCount = 0;
 
-    // Init ues
+    // Init ues, only the first instance creates the endpoint
     _UnifiedEventSource::_UnifiedEventSource()
     {
-        if (-1 == ::socketpair(AF_UNIX, SOCK_STREAM, 0, _uesfd))
+        if (_refCount++ > 0)
+        {
+            return;
+        }
+        ::sigemptyset(&_sigMask);
+        _signalFd = ::signalfd(-1, &_sigMask, SFD_NONBLOCK | SFD_CLOEXEC);
+        if (-1 == _signalFd)
         {
             LOGFATAL() << "UES endpoint init failed: " << ::strerror(errno) << std::endl;
         }
-        // Set ues fd write non-blocking
-        ::fcntl(_uesfd[1], F_SETFL, ::fcntl(_uesfd[1], F_GETFL) | O_NONBLOCK);
     }
 
-    // Close fd
+    // Close fd when the last instance goes away
     _UnifiedEventSource::~_UnifiedEventSource()
     {
-        ::close(_uesfd[1]);
-        ::close(_uesfd[0]);
-    }
-
-    // Wrire signal to uesfd
-    void _UnifiedEventSource::signalTransfer(int sig)
-    {
-        LOGNOTICE() << "Catch signal, signal " << sig << std::endl;
-        ::write(_uesfd[1], reinterpret_cast<char*>(&sig), 1);
+        if (--_refCount > 0)
+        {
+            return;
+        }
+        ::close(_signalFd);
+        _signalFd = -1;
     }
 
     // Bind signal
     void _UnifiedEventSource::bindSignal(int sig)
     {
-        struct sigaction act;
-        ::memset(&act, 0, sizeof(struct sigaction));
-        act.sa_handler = signalTransfer;
-        ::sigemptyset(&act.sa_mask);
-        ::sigaddset(&act.sa_mask, sig);
-        act.sa_flags |= SA_RESTART;
-        if (-1 == ::sigaction(sig, &act, nullptr))
+        sigset_t set;
+        ::sigemptyset(&set);
+        ::sigaddset(&set, sig);
+        ::sigaddset(&_sigMask, sig);
+        int err = ::pthread_sigmask(SIG_BLOCK, &set, nullptr);
+        if ((err != 0) || (-1 == ::signalfd(_signalFd, &_sigMask, 0)))
         {
-            LOGFATAL() << "Signal redirect failed: " << ::strerror(errno) << std::endl;
+            LOGFATAL() << "Signal redirect failed: " << ::strerror(err ? err : errno) << std::endl;
         }
         else
         {
@@ -54,27 +56,29 @@ namespace jrNetWork
         }
     }
 
-    bool _UnifiedEventSource::handleSignals(std::unordered_map<int, std::function<void()> >& sigHandlerTbl)
+    // Drain the signalfd, a burst of one signal costs a read per 32 deliveries
+    void _UnifiedEventSource::handleSignals(std::unordered_map<int, std::function<void()> >& sigHandlerTbl)
     {
-        char sig[32];
-        bool isTimeout = false;
-        ::memset(sig, 0, sizeof(sig));
-        int num = ::read(_uesfd[0], sig, sizeof(sig));
-        if (num <= 0)
-        {
-            return false;
-        }
-        for (int i = 0; i < num; ++i)
+        signalfd_siginfo infos[32];
+        for (;;)
         {
-            if (sig[i] == SIGALRM)
+            ssize_t num = ::read(_signalFd, infos, sizeof(infos));
+            if (num <= 0)
+            {
+                break;
+            }
+            for (std::size_t i = 0; i < num / sizeof(signalfd_siginfo); ++i)
             {
-                isTimeout = true;
+                auto it = sigHandlerTbl.find(static_cast<int>(infos[i].ssi_signo));
+                if ((it != sigHandlerTbl.end()) && it->second)
+                {
+                    it->second();
+                }
             }
-            else
+            if (static_cast<std::size_t>(num) < sizeof(infos))
             {
-                sigHandlerTbl[sig[i]]();
+                break;
             }
         }
-        return isTimeout;
     }
 }
@@ -2,18 +2,26 @@
 
 #include <functional>
 #include <unordered_map>
+#include <signal.h>
 
 namespace jrNetWork
 {
+    /* Unified event source: bound signals are blocked and read from a signalfd,
+     * so they arrive as regular loop events and no code runs in signal context.
+     */
     struct _UnifiedEventSource
     {
-        static int _uesfd[2];
+        static int _signalFd;
+        /* Signals routed to the signalfd */
+        static sigset_t _sigMask;
+        /* Number of living instances, the endpoint is shared by the whole process */
+        static int _refCount;
 
         _UnifiedEventSource();
         ~_UnifiedEventSource();
 
-        static void signalTransfer(int sig);
+        /* Block sig and route it to the signalfd, threads created afterwards inherit the mask */
         static void bindSignal(int sig);
-        static bool handleSignals(std::unordered_map<int, std::function<void()> >& sigHandlerTbl);
+        static void handleSignals(std::unordered_map<int, std::function<void()> >& sigHandlerTbl);
     };
 }
@@ -1,22 +1,48 @@
 #include "HttpReqParser.h"
 #include <sstream>
+#include <charconv>
 #include <unordered_map>
 
 namespace jrHTTP
 {
-    static bool peerIsClosed = false;
-    static int innerRetCode = 200;
     static const std::string httpVersion = "HTTP/1.0";
-    static std::unordered_map<std::string, std::string> reqTbl;
-    static std::unordered_map<std::string, std::string> retTbl = { {"Server", "jrHTTP"},
-                                                                   {"Connection", "Keep-Alive"} };
+    static const std::unordered_map<std::string, std::string> retTbl = { {"Server", "jrHTTP"},
+                                                                         {"Connection", "Keep-Alive"} };
     static const std::unordered_map<int, std::string> statusTbl = { {200, "OK"},
                                                                     {400, "Bad Request"}, 
                                                                     {404, "Not Found"},
+                                                                    {413, "Payload Too Large"},
+                                                                    {431, "Request Header Fields Too Large"},
                                                                     {500, "Internal Server Error"}, 
                                                                     {501, "Not Implemented"} };
 
-    static bool parserRequestLine(std::shared_ptr<jrNetWork::TCP::Socket> client)
+    /* Per-request parser state, requests of different loops are parsed concurrently */
+    struct _ParserState
+    {
+        bool peerIsClosed = false;
+        int innerRetCode = 200;
+        std::unordered_map<std::string, std::string> reqTbl;
+    };
+
+    /* Byte sources of the state machines: a socket read byte by byte, or a buffered request */
+    struct _SocketSource
+    {
+        const std::shared_ptr<jrNetWork::TCP::Socket>& client;
+
+        std::string next() { return client->recv(1); }
+    };
+
+    struct _StringSource
+    {
+        std::string_view data;
+        std::size_t pos;
+        std::size_t end;
+
+        std::string next() { return (pos < end) ? std::string(1, data[pos++]) : std::string(); }
+    };
+
+    template<class Source>
+    static bool parserRequestLine(Source& src, _ParserState& st)
     {
         enum State { METHOD, URL, VERSION, END, ERROR };
         State state = METHOD;
@@ -24,10 +50,10 @@ namespace jrHTTP
         std::string method, url, version;
         while (!stop)
         {
-            auto recv = client->recv(1);
+            auto recv = src.next();
             if (recv.empty())
             {
-                peerIsClosed = true;
+                st.peerIsClosed = true;
                 break;
             }
             if ((state != URL) && (recv[0] >= 'A' && recv[0] <= 'Z'))
@@ -72,32 +98,33 @@ namespace jrHTTP
             case END:
                 if (recv[0] != '\n')
                 {
-                    innerRetCode = 400;
+                    st.innerRetCode = 400;
                     return false;
                 }
                 stop = true;
                 break;
             case ERROR:
-                innerRetCode = 400;
+                st.innerRetCode = 400;
                 return false;
             }
         }
         if (!stop)
         {
-            innerRetCode = 500;
+            st.innerRetCode = 500;
             return false;
         }
         else
         {
-            innerRetCode = 200;
-            reqTbl["method"] = method;
-            reqTbl["url"] = url;
-            reqTbl["version"] = version;
+            st.innerRetCode = 200;
+            st.reqTbl["method"] = method;
+            st.reqTbl["url"] = url;
+            st.reqTbl["version"] = version;
             return true;
         }
     }
 
-    static bool parserRequestHead(std::shared_ptr<jrNetWork::TCP::Socket> client)
+    template<class Source>
+    static bool parserRequestHead(Source& src, _ParserState& st)
     {
         enum State { KEY, VALUE, NEXT_LINE, LINE_END, END, ERROR };
         State state = KEY;
@@ -111,10 +138,10 @@ namespace jrHTTP
         };
         while (!stop)
         {
-            auto recv = client->recv(1);
+            auto recv = src.next();
             if (recv.empty())
             {
-                peerIsClosed = true;
+                st.peerIsClosed = true;
                 break;
             }
             if (recv[0] >= 'A' && recv[0] <= 'Z')
@@ -150,7 +177,7 @@ namespace jrHTTP
                 {
                     removeFrontSpace(key);
                     removeFrontSpace(value);
-                    reqTbl[key] = value;
+                    st.reqTbl[key] = value;
                     key = value = "";
                     state = LINE_END;
                 }
@@ -177,20 +204,20 @@ namespace jrHTTP
             case END:
                 if (recv[0] != '\n')
                 {
-                    innerRetCode = 400;
+                    st.innerRetCode = 400;
                     return false;
                 }
                 stop = true;
                 break;
             case ERROR:
-                innerRetCode = 400;
+                st.innerRetCode = 400;
                 return false;
             }
         }
         return true;
     }
 
-    static std::string parserRequestBody(std::shared_ptr<jrNetWork::TCP::Socket> client, int contentLength)
+    static std::string parserRequestBody(const std::shared_ptr<jrNetWork::TCP::Socket>& client, std::size_t contentLength)
     {
         std::string content;
         while (contentLength--)
@@ -203,9 +230,16 @@ namespace jrHTTP
     }
 
     std::string HttpReqParser::buildReqResponse(int retCode, const std::string& content)
+    {
+        /* Attach response body */
+        return buildReqResponseHead(retCode, content.length()) + content;
+    }
+
+    std::string HttpReqParser::buildReqResponseHead(int retCode, std::size_t contentLength)
     {
         /* Set content length */
-        retTbl["Content-Length"] = std::to_string(content.length());
+        auto headTbl = retTbl;
+        headTbl["Content-Length"] = std::to_string(contentLength);
         /* Build status line */
         std::stringstream ss;
         ss << httpVersion << " "
@@ -213,38 +247,118 @@ namespace jrHTTP
            << statusTbl.at(retCode) << "\r\n";
         std::string ret(ss.str());
         /* Build response header */
-        for (const auto& p : retTbl)
+        for (const auto& p : headTbl)
         {
             ret += (p.first + ":" + p.second + "\r\n");
         }
         ret += "\r\n";
-        /* Attach response body */
-        ret += content;
         return ret;
     }
 
-    HttpReqParser::Result HttpReqParser::parserReq(std::shared_ptr<jrNetWork::TCP::Socket> client)
+    /* Value of a content-length header, false when it is not a number; one beyond size_t
+     * reads as SIZE_MAX, which no limit admits
+     */
+    static bool parseContentLength(const std::string& value, std::size_t& length)
+    {
+        const char* first = value.data();
+        const char* last = value.data() + value.size();
+        while ((last != first) && (*(last - 1) == ' '))
+        {
+            --last;
+        }
+        auto res = std::from_chars(first, last, length);
+        if (res.ec == std::errc::result_out_of_range)
+        {
+            length = SIZE_MAX;
+        }
+        return (first != last) && (res.ptr == last) && ((res.ec == std::errc()) || (res.ec == std::errc::result_out_of_range));
+    }
+
+    /* Method of a parsed request head */
+    static HttpMethod parsedMethod(_ParserState& st)
+    {
+        return (st.reqTbl["method"] == "get") ? HttpMethod::GET : HttpMethod::POST;
+    }
+
+    HttpReqParser::Result HttpReqParser::parserReq(const std::shared_ptr<jrNetWork::TCP::Socket>& client)
     {
         HttpReqParser::Result ret;
-        if (parserRequestLine(client) && parserRequestHead(client))
+        _ParserState st;
+        _SocketSource src{client};
+        if (parserRequestLine(src, st) && parserRequestHead(src, st))
         {
-            if (reqTbl["method"] == "get")
+            ret.method = parsedMethod(st);
+            ret.url = st.reqTbl["url"];
+            std::size_t contentLength = 0;
+            if (st.reqTbl.count("content-length") != 0)
             {
-                ret.method = HttpMethod::GET;
+                if (!parseContentLength(st.reqTbl["content-length"], contentLength))
+                {
+                    ret.retCode = 400;
+                    return ret;
+                }
+                ret.content = parserRequestBody(client, contentLength);
             }
-            else
+        }
+        ret.retCode = st.peerIsClosed ? 0 : st.innerRetCode;
+        return ret;
+    }
+
+    bool HttpReqParser::parserReq(std::string_view data, RequestView& ret, std::size_t& consumed, std::size_t& scanned,
+                                  const RequestLimits& limits)
+    {
+        /* The terminator may straddle what was scanned before and what arrived since */
+        std::size_t headEnd = data.find("\r\n\r\n", (scanned > 3) ? scanned - 3 : 0);
+        ret = RequestView();
+        if (headEnd == std::string::npos)
+        {
+            scanned = data.size();
+            if (data.size() > limits.maxHeadBytes)
             {
-                ret.method = HttpMethod::POST;
+                ret.retCode = 431;
+                consumed = data.size();
+                return true;
             }
-            ret.url = reqTbl["url"];
-            if (reqTbl.count("content-length") != 0)
+            return false;
+        }
+        scanned = headEnd;
+        headEnd += 4;
+        consumed = headEnd;
+        if (headEnd > limits.maxHeadBytes)
+        {
+            ret.retCode = 431;
+            return true;
+        }
+        _ParserState st;
+        _StringSource src{data, 0, headEnd};
+        if (parserRequestLine(src, st) && parserRequestHead(src, st))
+        {
+            ret.method = parsedMethod(st);
+            /* The request line was accepted, so the url is what lies between its first two spaces */
+            std::size_t urlBegin = data.find(' ') + 1;
+            ret.url = data.substr(urlBegin, data.find(' ', urlBegin) - urlBegin);
+            if (st.reqTbl.count("content-length") != 0)
             {
-                ret.content = parserRequestBody(client, std::stoi(reqTbl["content-length"]));
+                std::size_t contentLength = 0;
+                if (!parseContentLength(st.reqTbl["content-length"], contentLength))
+                {
+                    ret.retCode = 400;
+                    return true;
+                }
+                if (contentLength > limits.maxBodyBytes)
+                {
+                    ret.retCode = 413;
+                    return true;
+                }
+                if (data.size() - headEnd < contentLength)
+                {
+                    return false;
+                }
+                ret.content = data.substr(headEnd, contentLength);
+                consumed += contentLength;
             }
         }
-        ret.retCode = peerIsClosed ? 0 : innerRetCode;
-        innerRetCode = 200;
-        reqTbl.clear();
-        return ret;
+        ret.retCode = st.innerRetCode;
+        return true;
     }
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <memory>
 #include <variant>
 #include "../network/Socket.h"
@@ -12,13 +13,43 @@ namespace jrHTTP
 	{
 		struct Result
 		{
-			int retCode;
-			HttpMethod method;
+			int retCode = 0;
+			HttpMethod method = HttpMethod::GET;
 			std::string url;
 			std::string content;
 		};
 
+		/* Request parsed in place: url and content point into the parsed data and are valid
+		 * as long as it is not consumed
+		 */
+		struct RequestView
+		{
+			int retCode = 0;
+			HttpMethod method = HttpMethod::GET;
+			std::string_view url;
+			std::string_view content;
+		};
+
+		/* Largest request head and body a server buffers, larger ones are answered with 431 / 413 */
+		struct RequestLimits
+		{
+			std::size_t maxHeadBytes = 64 * 1024;
+			std::size_t maxBodyBytes = 8 * 1024 * 1024;
+		};
+
 		std::string buildReqResponse(int retCode, const std::string& content);
-		Result parserReq(std::shared_ptr<jrNetWork::TCP::Socket> client);
+		/* Status line and headers only, for sending the body as a separate chunk */
+		std::string buildReqResponseHead(int retCode, std::size_t contentLength);
+		/* Read and parse one request from the socket, byte by byte */
+		Result parserReq(const std::shared_ptr<jrNetWork::TCP::Socket>& client);
+		/* Parse the request at the head of data without reading: false while it is incomplete,
+		 * otherwise consumed is the length of the request in data. A request beyond limits, or
+		 * with a malformed head, is complete at once with an error retCode and must not be
+		 * served further on the connection, its framing is unknown.
+		 * scanned is how far data was searched for the end of the head: start each request at 0
+		 * and keep it between calls, so a head arriving in pieces is scanned once.
+		 */
+		bool parserReq(std::string_view data, RequestView& ret, std::size_t& consumed, std::size_t& scanned,
+		               const RequestLimits& limits);
 	}
 }
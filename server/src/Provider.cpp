@@ -22,11 +22,12 @@ namespace jrRPC
 	};
 
 	/* Deserialization a received string */
-	static _ProcInfo _deserialization(const std::string& proc)
+	static _ProcInfo _deserialization(std::string_view proc)
 	{
 		_ProcInfo p;
-		p.name = nlohmann::json::parse(proc).at("name");
-		p.param = nlohmann::json::parse(proc).at("parameters");
+		nlohmann::json msg = nlohmann::json::parse(proc.begin(), proc.end());
+		p.name = msg.at("name");
+		p.param = std::move(msg.at("parameters"));
 		return p;
 	}
 
@@ -42,7 +43,7 @@ namespace jrRPC
 		return p;
 	}
 
-	std::string Provider::callProc(const std::string& proc)
+	std::string Provider::callProc(std::string_view proc)
 	{
 		nlohmann::json msg;
 		_ProcInfo p = _deserialization(proc);
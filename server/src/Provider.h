@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <functional>
 #include <unordered_map>
 #include "../third/json.hpp"
@@ -55,6 +56,6 @@ namespace jrRPC
 		static Provider& instance();
 
 		/* Do proc call */
-		std::string callProc(const std::string& proc);
+		std::string callProc(std::string_view proc);
 	};
 }
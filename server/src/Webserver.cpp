@@ -1,7 +1,6 @@
 #include "Webserver.h"
 #include <sys/wait.h>
 #include <unistd.h>
-#include <fstream>
 #include "HttpReqParser.h"
 #include "../network/Log.h"
 #include "Provider.h"
@@ -13,33 +12,159 @@ namespace jrHTTP
         LOGWARN() << "Connection closed by peer" << std::endl;
     }
 
-    HTTPServer::HTTPServer(std::uint16_t port, std::uint16_t maxPoolSize)
-        : _dispatcher(port, maxPoolSize)
+    HTTPServer::HTTPServer(std::uint16_t port, std::uint16_t maxPoolSize, std::uint16_t reactorNum,
+                           jrNetWork::ReactorMode mode)
+        : _dispatcher(port, reactorNum, maxPoolSize, mode)
         , _fileMappingPath(std::string(__FILE__).substr(0, std::string(__FILE__).find_last_of('/'))+"/source") 
     {
         _dispatcher.setSignalEventHandler(SIGPIPE, handleSIGPIPE);
+        /* Small RPC responses must not wait for Nagle */
+        _dispatcher.setSocketTuning(jrNetWork::SocketTuning::latency());
+        /* Most keep-alive connections are idle, they should not hold a buffer between requests */
+        _dispatcher.setBufferRelease(std::chrono::milliseconds(0), true);
         /* Set http handler */
-        _dispatcher.setReadEventHandler(&HTTPServer::_handleHttpMsg, this);
+        _dispatcher.setCoroutineHandler(&HTTPServer::_serveHttp, this);
     }
 
-    int HTTPServer::run(std::uint16_t timeoutMs) 
+    void HTTPServer::setMaxConnections(std::size_t highWater, std::size_t lowWater, bool reject)
     {
-        return _dispatcher.run(timeoutMs);
+        _dispatcher.setMaxConnections(highWater, lowWater,
+                                      reject ? jrNetWork::OverloadPolicy::REJECT : jrNetWork::OverloadPolicy::PAUSE_ACCEPT,
+                                      "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
     }
 
-    void HTTPServer::_handleHttpMsg(std::shared_ptr<jrNetWork::TCP::Socket> client) 
+    std::size_t HTTPServer::connectionNum() const
+    {
+        return _dispatcher.connectionNum();
+    }
+
+    void HTTPServer::setPlacement(jrNetWork::PlacementPolicy policy)
+    {
+        _dispatcher.setPlacement(std::move(policy));
+    }
+
+    void HTTPServer::setBacklog(int backlog)
+    {
+        _dispatcher.setBacklog(backlog);
+    }
+
+    void HTTPServer::setSocketTuning(const std::string& profile)
+    {
+        _dispatcher.setSocketTuning(jrNetWork::SocketTuning::byName(profile));
+    }
+
+    void HTTPServer::setZeroCopyThreshold(std::size_t threshold)
+    {
+        _dispatcher.setZeroCopy(threshold);
+    }
+
+    void HTTPServer::setFileCacheSize(std::size_t capacity, std::size_t maxContentBytes)
+    {
+        _fileCache.setCapacity(capacity);
+        _fileCache.setMaxContentSize(maxContentBytes);
+    }
+
+    void HTTPServer::setBufferRelease(std::uint32_t idleMs, bool onDrain)
+    {
+        _dispatcher.setBufferRelease(std::chrono::milliseconds(idleMs), onDrain);
+    }
+
+    std::uint64_t HTTPServer::reclaimedBufferBytes() const
+    {
+        return _dispatcher.reclaimedBytes();
+    }
+
+    void HTTPServer::setHugePageBuffers(bool on)
+    {
+        jrNetWork::BlockPool::instance().setHugePages(on);
+    }
+
+    void HTTPServer::setMaxRequestSize(std::size_t maxHeadBytes, std::size_t maxBodyBytes)
+    {
+        _requestLimits.maxHeadBytes = maxHeadBytes;
+        _requestLimits.maxBodyBytes = maxBodyBytes;
+    }
+
+    void HTTPServer::setBusyPoll(std::uint32_t budgetUs)
+    {
+        _dispatcher.setBusyPoll(budgetUs);
+    }
+
+    int HTTPServer::run(std::chrono::milliseconds idleTimeout) 
+    {
+        return _dispatcher.run(idleTimeout);
+    }
+
+    jrNetWork::Task<> HTTPServer::_serveHttp(jrNetWork::AsyncSocket<jrNetWork::TCP::Socket> client)
+    {
+        jrNetWork::Buffer input;
+        while (client.isOpen())
+        {
+            /* Buffer input until a whole request is in, pipelined requests stay for the next round */
+            HttpReqParser::RequestView result;
+            std::size_t consumed = 0;
+            std::size_t scanned = 0;
+            while (!HttpReqParser::parserReq(input.view(), result, consumed, scanned, _requestLimits))
+            {
+                if (0 == co_await client.read(input))
+                {
+                    LOGNOTICE() << "Peer is closed!" << std::endl;
+                    co_return;
+                }
+            }
+            if (result.retCode != 200)
+            {
+                /* Oversized or malformed: answer and close, what follows on the connection cannot be framed */
+                LOGNOTICE() << "Request refused with " << result.retCode << std::endl;
+                co_await client.write(HttpReqParser::buildReqResponseHead(result.retCode, 0));
+                client.socket()->shutdown();
+                co_return;
+            }
+            /* Files, CGI programs and RPC procedures may block or be CPU bound, keep them off the loop;
+             * the request is handled in place, so it leaves the input buffer only afterwards
+             */
+            int retCode = result.retCode;
+            std::string content;
+            jrNetWork::FileCache::FilePtr file;
+            co_await jrNetWork::offload([this, &result, &retCode, &content, &file]()->void
+            {
+                content = _handleRequest(result, retCode, file);
+            });
+            input.consume(consumed);
+            /* Head and body go out in one gather write, the body is not copied behind the head;
+             * a small static file is queued from the cache's shared copy, a larger one goes from
+             * the page cache to the socket by sendfile
+             */
+            jrNetWork::ChunkQueue response;
+            std::string head = HttpReqParser::buildReqResponseHead(retCode, file ? file->size() : content.size());
+            response.push(std::move(head));
+            if (file && !file->content.empty())
+            {
+                response.push(file->content);
+            }
+            else if (file)
+            {
+                response.pushFile(file, 0, file->size());
+            }
+            else
+            {
+                response.push(std::move(content));
+            }
+            co_await client.write(std::move(response));
+        }
+    }
+
+    std::string HTTPServer::_handleRequest(const HttpReqParser::RequestView& result, int& retCode,
+                                           jrNetWork::FileCache::FilePtr& file)
     {
-        /* Get the parser result */
-        HttpReqParser::Result result = HttpReqParser::parserReq(client);
-        int retCode = result.retCode;
         std::string content;
         switch (result.method)
         {
         case HttpMethod::GET:
-            content = _handleGetReq(result.url, retCode);
+            content = _handleGetReq(result.url, retCode, file);
             break;
         case HttpMethod::POST:
-            if (result.url.substr(result.url.length() - 3, 3) == "RPC")
+            if ((result.url.length() >= 3) && (result.url.substr(result.url.length() - 3, 3) == "RPC"))
             {
                 content = _handleRpcCall(result.content);
             }
@@ -51,31 +176,20 @@ namespace jrHTTP
         default:
             break;
         }
-        /* Send ret data */
-        if (retCode != 0)
-        {
-            auto s = HttpReqParser::buildReqResponse(retCode, content);
-            LOGNOTICE() << "Send:\n" << s << std::endl;
-            client->send(s);
-        }
-        else
-        {
-            LOGNOTICE() << "Peer is closed!" << std::endl;
-        }
+        return content;
     }
 
-    std::string HTTPServer::_handleGetReq(const std::string &url, int &ret_code) 
+    std::string HTTPServer::_handleGetReq(std::string_view url, int &ret_code, jrNetWork::FileCache::FilePtr& file) 
     {
         std::size_t pos = url.find('?');
         if(pos == std::string::npos) 
         {
-            /* Static resource */
-            std::ifstream file(_fileMappingPath+url);
-            if(file.is_open()) 
+            /* Static resource, sent from the cached fd */
+            file = _fileCache.open(_fileMappingPath+std::string(url));
+            if(file) 
             {
                 ret_code = 200;
-                return std::string(std::istreambuf_iterator<char>(file),
-                                   std::istreambuf_iterator<char>());
+                return "";
             } 
             else 
             {
@@ -86,13 +200,13 @@ namespace jrHTTP
         else 
         {
             /* Dynamic resource */
-            std::string path = url.substr(0, pos);
-            std::string parameters = url.substr(pos+1, url.length());
+            std::string path(url.substr(0, pos));
+            std::string parameters(url.substr(pos+1, url.length()));
             return _execCgi(path, parameters, ret_code, "GET");
         }
     }
 
-    std::string HTTPServer::_handleRpcCall(const std::string& content)
+    std::string HTTPServer::_handleRpcCall(std::string_view content)
     {
         return jrRPC::Provider::instance().callProc(content);
     }
@@ -123,6 +237,10 @@ namespace jrHTTP
         } 
         else if(0 == pid) 
         {
+             /* The blocked mask of the server survives exec, give the CGI program default signals */
+             sigset_t set;
+             ::sigemptyset(&set);
+             ::sigprocmask(SIG_SETMASK, &set, nullptr);
              ::close(cgi_input[1]);
              ::close(cgi_output[0]);
              ::dup2(cgi_input[0], STDIN_FILENO);
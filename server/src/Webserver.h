@@ -2,7 +2,8 @@
 
 #include <string>
 #include <unordered_map>
-#include "../network/EventLoop.h"
+#include "../network/EventLoopGroup.h"
+#include "HttpReqParser.h"
 
 namespace jrHTTP 
 {
@@ -12,24 +13,70 @@ namespace jrHTTP
         using HashMap = std::unordered_map<std::string, std::string>;
 
     private:
-        jrNetWork::EventLoop<jrNetWork::TCP::Socket> _dispatcher;
+        jrNetWork::EventLoopGroup<jrNetWork::TCP::Socket> _dispatcher;
         HashMap _retHeadTbl;
         const std::string _fileMappingPath;
+        /* Open static files, shared by the loops and workers */
+        jrNetWork::FileCache _fileCache;
+        HttpReqParser::RequestLimits _requestLimits;
 
     private:
-        /* Parser http data by state machine, then send ret data */
-        void _handleHttpMsg(std::shared_ptr<jrNetWork::TCP::Socket> client);
+        /* Serve the requests of a connection until the peer closes it */
+        jrNetWork::Task<> _serveHttp(jrNetWork::AsyncSocket<jrNetWork::TCP::Socket> client);
+        /* Response body of a parsed request, retCode comes in as the parser's and may be changed.
+         * A static file is returned in file instead of the body.
+         */
+        std::string _handleRequest(const HttpReqParser::RequestView& result, int& retCode, jrNetWork::FileCache::FilePtr& file);
         /* Get static or dynamic resources */
-        std::string _handleGetReq(const std::string& url, int& ret_code);
+        std::string _handleGetReq(std::string_view url, int& ret_code, jrNetWork::FileCache::FilePtr& file);
         /* RPC request(use POST req) */
-        std::string _handleRpcCall(const std::string& content);
+        std::string _handleRpcCall(std::string_view content);
         /* Execute CGI program */
         std::string _execCgi(const std::string& path, const std::string& parameters, int& ret_code, std::string method);
 
     public:
-        /* Init network connection */
-        HTTPServer(std::uint16_t port, std::uint16_t maxPoolSize = std::thread::hardware_concurrency());
-        /* Start HTTP-RPC server */
-        int run(std::uint16_t timeoutMs = 300);
+        /* Init network connection, reactorNum > 1 runs one loop per thread,
+         * spread by SO_REUSEPORT or by an acceptor loop according to mode
+         */
+        HTTPServer(std::uint16_t port, std::uint16_t maxPoolSize = std::thread::hardware_concurrency(),
+                   std::uint16_t reactorNum = 1,
+                   jrNetWork::ReactorMode mode = jrNetWork::ReactorMode::REUSEPORT);
+        /* Bound the number of connections: above highWater new ones are paused in the backlog,
+         * or answered with 503 and closed when reject is set; accepting resumes at lowWater
+         */
+        void setMaxConnections(std::size_t highWater, std::size_t lowWater, bool reject = false);
+        /* Connections being served */
+        std::size_t connectionNum() const;
+        /* Pin loops and workers on CPUs, see jrNetWork::PlacementPolicy */
+        void setPlacement(jrNetWork::PlacementPolicy policy);
+        /* Listen backlog (default SOMAXCONN) */
+        void setBacklog(int backlog);
+        /* Socket options by profile name: latency (the default), throughput, bulk or default
+         * for the kernel's settings; throws on other names
+         */
+        void setSocketTuning(const std::string& profile);
+        /* Send response bodies of at least threshold bytes with MSG_ZEROCOPY, 0 (default) for off */
+        void setZeroCopyThreshold(std::size_t threshold);
+        /* Number of static files kept open (default 256), 0 opens them on every request;
+         * files up to maxContentBytes are also kept in memory, shared by all responses
+         */
+        void setFileCacheSize(std::size_t capacity, std::size_t maxContentBytes = 64 * 1024);
+        /* Give buffer memory of quiet connections back to the pool after idleMs waiting for input
+         * (0 for never) and, with onDrain, as soon as a response is drained; the server starts
+         * with release on drain only
+         */
+        void setBufferRelease(std::uint32_t idleMs, bool onDrain);
+        /* Buffer memory given back so far, in bytes */
+        std::uint64_t reclaimedBufferBytes() const;
+        /* Largest request head (default 64 KB) and body (default 8 MB) buffered for a request,
+         * larger ones are answered with 431 / 413 and the connection is closed
+         */
+        void setMaxRequestSize(std::size_t maxHeadBytes, std::size_t maxBodyBytes);
+        /* Back the process-wide pool of connection buffers with 2 MB huge pages, call it before run */
+        void setHugePageBuffers(bool on);
+        /* Low latency mode for latency-bound RPC traffic: loops spin budgetUs before blocking */
+        void setBusyPoll(std::uint32_t budgetUs);
+        /* Start HTTP-RPC server, idleTimeout is the idle timeout of connections */
+        int run(std::chrono::milliseconds idleTimeout = std::chrono::seconds(300));
     };
 }